@@ -0,0 +1,50 @@
+#ifndef REQUEST_POOL
+#define REQUEST_POOL
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// A free list of request objects, so that the event loops don't call new/delete for every operation.
+// Requests are stored in fixed size slabs which never move, so pointers to them stay valid as the pool grows,
+// and each request knows its own index (pool_idx), which is what gets stored in an SQE's user_data.
+// Only use a pool from the thread which owns it.
+// T needs a uint64_t pool_idx member, and a reset() function which readies it for reuse (ideally keeping any buffers' memory)
+
+namespace request_pool_namespace {
+  template<typename T, int SLAB_SIZE = 256>
+  class request_pool {
+    std::vector<std::unique_ptr<T[]>> slabs{};
+    std::vector<uint64_t> free_idxs{};
+
+  public:
+    T *acquire(){ // gets a free request, only allocates if every request in the pool is in use
+      if(free_idxs.size() == 0){
+        const uint64_t first_idx = slabs.size() * SLAB_SIZE;
+        slabs.emplace_back(new T[SLAB_SIZE]);
+        for(uint64_t idx = first_idx + SLAB_SIZE; idx > first_idx; idx--) // reversed so lower indexes are handed out first
+          free_idxs.push_back(idx - 1);
+      }
+
+      const auto idx = free_idxs.back();
+      free_idxs.pop_back();
+
+      T *item = get(idx);
+      item->pool_idx = idx;
+      return item;
+    }
+
+    T *get(uint64_t idx){ // i.e using the user_data from a CQE
+      return &slabs[idx / SLAB_SIZE][idx % SLAB_SIZE];
+    }
+
+    void release(T *item){ // gives the request back to the pool
+      const auto idx = item->pool_idx;
+      item->reset();
+      item->pool_idx = idx;
+      free_idxs.push_back(idx);
+    }
+  };
+}
+
+#endif
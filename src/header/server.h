@@ -17,19 +17,26 @@
 #include <wolfssl/ssl.h>
 
 #include <queue>
+#include <deque>
+#include <climits> //for IOV_MAX
+#include <cstdint>
 #include <iostream> //for string and iostream stuff
 #include <unordered_map>
 #include <unordered_set>
 #include <set> //ordered set for freed indexes, I believe it is sorted in ascending order which is exactly what we want
 #include <chrono>
 #include <mutex>
+#include <memory>
 
 #include "server_metadata.h"
 #include "utility.h"
+#include "request_pool.h"
+#include "shared_buffer.h"
+#include "session_tickets.h"
 
 namespace tcp_tls_server {
   //the wolfSSL callbacks
-  int tls_recv_helper(server<server_type::TLS> *tcp_server, int client_idx, char *buff, int sz, bool accept);
+  int tls_recv_helper(server<server_type::TLS> *tcp_server, int client_idx, char *buff, int sz);
   int tls_recv(WOLFSSL* ssl, char* buff, int sz, void* ctx);
   int tls_send(WOLFSSL* ssl, char* buff, int sz, void* ctx);
 
@@ -57,37 +64,10 @@ namespace tcp_tls_server {
   // extern uint64_t mem_usage_customread;
   // extern uint64_t mem_usage_accept;
 
-  struct request {
-    // fields used for any request
-    event_type event;
-    int client_idx = -1;
-    int ID = -1;
-
-    // fields used for write requests
-    size_t written{}; //how much written so far
-    size_t total_length{}; //how much data is in the request, in bytes
-    const char *buffer = nullptr;
-
-    // fields used for read requests
-    std::vector<char> read_data{};
-    size_t read_amount{}; //how much has been read (in case of multi read requests)
-    
-    // extra
-    int64_t custom_info{}; //any custom info you want to attach to the request
-  };
-
-  struct multi_write {
-    multi_write(std::vector<char> &&buff, int uses) : buff(std::move(buff)), uses(uses) {}
-    std::vector<char> buff;
-    int uses{}; //this should be decremented each time you would normally delete this object, when it reaches 0, then delete
-  };
-
-  struct write_data { //this is closer to 3 objects in 1
-    int last_written = -1;
-
+  struct write_data { //this is closer to 4 objects in 1
     int64_t custom_info{};
 
-    write_data(std::vector<char> &&buff, uint64_t custom_info = 0) : buff(buff), custom_info(custom_info) {}
+    write_data(std::vector<char> &&buff, uint64_t custom_info = 0) : buff(std::move(buff)), custom_info(custom_info) {}
     std::vector<char> buff;
 
     write_data(const char *buff, size_t length, bool broadcast = false, uint64_t custom_info = 0) : ptr_buff(buff), total_length(length), broadcast(broadcast), custom_info(custom_info) {}
@@ -95,15 +75,42 @@ namespace tcp_tls_server {
     const char *ptr_buff = nullptr; //in the case you only want to write a char* ptr - this basically trusts that you won't invalidate the pointer
     size_t total_length{}; //used in conjunction with the above
 
-    write_data(multi_write *multi_write_data, uint64_t custom_info = 0) : multi_write_data(multi_write_data), custom_info(custom_info) {}
-    multi_write *multi_write_data = nullptr; //if not null then buff should be empty, and data should be in the multi_write pointer
+    //data shared with other writes (i.e a broadcast), each holds a reference, so it's freed when the last of them is done with
+    write_data(const shared_buffer_namespace::shared_buffer &shared_buff, bool broadcast = false, uint64_t custom_info = 0) : broadcast(broadcast), shared_buff(shared_buff), custom_info(custom_info) {}
+    shared_buffer_namespace::shared_buffer shared_buff{};
+
+    //sends length bytes of file_fd from offset, without copying it into user space, buff holds anything to send before it (i.e headers)
+    write_data(std::vector<char> &&headers, int file_fd, size_t offset, size_t length) : buff(std::move(headers)), file_fd(file_fd), file_offset(offset), file_remaining(length) {}
+    int file_fd = -1; //owned by this, closed once it's done with
+    size_t file_offset{}; //where the next chunk is read from
+    size_t file_remaining{}; //how much of the file is left to send
+
+    //sends a head (i.e response headers) and then length bytes of buff, as one writev for plain TCP, so they don't need copying together
+    //the head is either owned by this, or a pointer which has to stay valid until it's written (i.e headers kept in a cache entry)
+    write_data(std::vector<char> &&head, const char *buff, size_t length) : ptr_buff(buff), total_length(length), head_buff(std::move(head)) {}
+    write_data(const char *head, size_t head_length, const char *buff, size_t length) : ptr_buff(buff), total_length(length), head_ptr(head), head_length(head_length) {}
+    std::vector<char> head_buff{};
+    const char *head_ptr = nullptr;
+    size_t head_length{};
+
+    //TLS encrypts the head and then the data into the client's output, as there's room for them
+    size_t tls_encrypted{}; //how much of the head and data has been given to wolfSSL
+    uint64_t tls_end = UINT64_MAX; //where its last record ends in the client's encrypted stream, once it's all been encrypted
+
+    std::shared_ptr<const void> owner{}; //optionally holds whatever ptr_buff and head_ptr point into (i.e a cache entry), so they can be sent with zero copy
+
+    write_data(const write_data&) = delete; //the file_fd is owned, so this can only be moved
+    write_data(write_data &&other) : custom_info(other.custom_info), buff(std::move(other.buff)),
+      broadcast(other.broadcast), ptr_buff(other.ptr_buff), total_length(other.total_length), shared_buff(std::move(other.shared_buff)),
+      file_fd(other.file_fd), file_offset(other.file_offset), file_remaining(other.file_remaining), head_buff(std::move(other.head_buff)),
+      head_ptr(other.head_ptr), head_length(other.head_length), tls_encrypted(other.tls_encrypted), tls_end(other.tls_end), owner(std::move(other.owner))
+    {
+      other.file_fd = -1;
+    }
     
     ~write_data(){
-      if(multi_write_data){
-        multi_write_data->uses--;
-        if(multi_write_data->uses == 0)
-          delete multi_write_data;
-      }
+      if(file_fd != -1)
+        close(file_fd);
     }
 
     struct ptr_and_size {
@@ -113,23 +120,119 @@ namespace tcp_tls_server {
     };
     
     ptr_and_size get_ptr_and_size(){
-      if(multi_write_data){
-        return { &(multi_write_data->buff[0]), multi_write_data->buff.size() };
+      if(shared_buff){
+        return { shared_buff.data(), shared_buff.size() };
       }else if(ptr_buff){
         return { ptr_buff, total_length };
       }else{
         return { &buff[0], buff.size() };
       }
     }
+
+    bool has_head() const { return head_ptr || head_buff.size(); }
+    ptr_and_size get_head(){
+      if(head_ptr)
+        return { head_ptr, head_length };
+      return { head_buff.data(), head_buff.size() };
+    }
+
+    bool can_send_zero_copy() const { //if everything it sends stays valid for as long as this is kept (which pointers only do with an owner)
+      return file_fd == -1 && (owner || (!ptr_buff && !head_ptr));
+    }
+  };
+
+  struct request {
+    // fields used for any request
+    event_type event;
+    int client_idx = -1;
+    int ID = -1;
+
+    // fields used for write requests
+    size_t written{}; //how much written so far
+    size_t total_length{}; //how much data is in the request, in bytes
+    const char *buffer = nullptr;
+    std::vector<iovec> iovs{}; //for writev requests, kept until the request is done with, since the kernel reads it when it's submitted
+    size_t items{}; //how many send_data items a gathered write covers, 0 if it isn't one
+
+    // fields used for zero copy sends, the kernel reads straight from the buffers until it posts a notification for each send,
+    // so the request, and the items it sent, are only given back once the last notification arrives
+    bool zero_copy = false;
+    int zc_notifications{}; //how many notifications are still to come
+    bool zc_finished = false; //the write itself is done, so the last notification releases this
+    msghdr msg{}; //for sending several iovecs with sendmsg
+    std::deque<write_data> zc_items{}; //the finished items, kept until the kernel is done with their buffers
+
+    // fields used for read requests
+    std::vector<char> read_data{};
+    size_t read_amount{}; //how much has been read (in case of multi read requests)
+    size_t file_offset{}; //where in the file a custom read starts
+    
+    bool multishot = false; //multishot requests produce several CQEs, so they're only freed once the kernel stops them
+
+    // extra
+    int64_t custom_info{}; //any custom info you want to attach to the request
+
+    uint64_t pool_idx{}; //index in the request pool, this is what's stored as the SQE's user_data
+
+    void reset(){ //readies this for reuse by the pool, keeping the read buffer's (and iovecs') memory so reads don't need to allocate
+      auto buff = std::move(read_data);
+      auto iovecs = std::move(iovs);
+      const auto idx = pool_idx;
+      *this = request();
+      buff.clear();
+      iovecs.clear();
+      read_data = std::move(buff);
+      iovs = std::move(iovecs);
+      pool_idx = idx;
+    }
+  };
+
+  //bytes received for a TLS client which wolfSSL hasn't taken yet, taken from the front without moving what's left,
+  //which is only moved back to the start once there's less of it than has been taken, so on average each byte is moved at most once
+  class recv_buffer {
+    std::vector<char> buff{};
+    size_t start{}; //where the data which hasn't been taken starts
+  public:
+    const char *data() const { return buff.data() + start; }
+    size_t size() const { return buff.size() - start; }
+    bool empty() const { return size() == 0; }
+
+    void append(const char *data, size_t length){
+      const auto remaining = size();
+      if(start && start >= remaining){
+        std::memmove(&buff[0], &buff[start], remaining);
+        buff.resize(remaining);
+        start = 0;
+      }
+      buff.insert(buff.end(), data, data + length);
+    }
+
+    void consume(size_t length){
+      start += length;
+      if(start == buff.size()) //all taken, so the memory is kept for the next read
+        clear();
+    }
+
+    void clear(){
+      buff.clear();
+      start = 0;
+    }
   };
 
   struct client_base {
     int id = -1;
     int sockfd = -1;
-    std::queue<write_data> send_data{};
+    std::deque<write_data> send_data{}; //written in order, a deque so that several items at the front can be gathered into one write
 
     bool read_req_active = false;
+    int pipe_fds[2] = { -1, -1 }; //only made if a file is spliced to this client, it's the intermediate buffer for the splice
     int num_write_reqs = 0; // if this is non zero, then do not proceed with the close callback, wait for other requests to finish
+
+    //send_data owns what it sends, so clients are only ever moved (i.e when the clients vector grows)
+    client_base() = default;
+    client_base(const client_base&) = delete;
+    client_base(client_base&&) = default;
+    client_base &operator=(client_base&&) = default;
   };
 
   template<server_type T>
@@ -141,8 +244,22 @@ namespace tcp_tls_server {
   template<>
   struct client<server_type::TLS>: client_base {
       WOLFSSL *ssl = nullptr;
-      int accept_last_written = -1;
-      std::vector<char> recv_data{};
+      recv_buffer recv_data{};
+
+      //wolfSSL's records are added to tls_out as they're made, and it's all written in one go at the end of the event loop iteration,
+      //only one write is in flight at once, which sends tls_out_writing, while the next records build up in tls_out
+      std::vector<char> tls_out{};
+      std::vector<char> tls_out_writing{};
+      size_t tls_out_written{}; //how much of tls_out_writing has been written so far
+      uint64_t encrypted_total{}; //how many bytes wolfSSL has made for this client, send_data items are done once written_total reaches their tls_end
+      uint64_t written_total{};
+      bool flush_queued = false; //if it's in the server's clients_to_flush
+
+      bool ktls_rx = false; //the kernel decrypts what's received, so reads go straight to the read callback
+      bool ktls_tx_pending = false; //the kernel takes over sending once everything wolfSSL has encrypted is written
+      bool ktls = false; //the kernel encrypts what's sent, so send_data is written like a plain client's
+
+      bool early_data = false; //it's sent a request with the handshake, which is active before the handshake's finished
   };
 
   template<server_type T>
@@ -158,6 +275,13 @@ namespace tcp_tls_server {
       io_uring ring;
       void *custom_obj; //it can be anything
 
+      request_pool_namespace::request_pool<request> requests{}; //every request is taken from here and given back once its CQE is done with
+
+      const server_settings settings;
+      __kernel_timespec cqe_wait_timeout{}; //derived from the settings, used when waiting on a batch of completions
+      size_t zero_copy_threshold{}; //from the settings, but 0 if the kernel can't do zero copy sends
+      unsigned fixed_files{}; //from the settings, but 0 if the file table couldn't be registered, in which case client sockets are normal fds
+
       std::unordered_set<int> active_connections{};
       std::set<int> freed_indexes{}; //using a set to store free indexes instead
       std::vector<client<T>> clients{};
@@ -177,8 +301,43 @@ namespace tcp_tls_server {
       
       int setup_client(int client_idx);
 
+      //with fixed files a client's sockfd is its slot in the ring's file table rather than an fd, so every SQE using it has to say so
+      void use_client_socket(io_uring_sqe *sqe){ if(fixed_files) sqe->flags |= IOSQE_FIXED_FILE; }
+      void close_client_socket(int client_idx); //stops any read on it and closes it
+
       void event_read(int event_fd, event_type event); //will set a read request for the eventfd
 
+      //SPLICE_IN moves up to length bytes of the front file in send_data into the client's pipe, SPLICE_OUT moves length bytes from the pipe to the socket
+      void add_splice_req(int client_idx, event_type event, size_t length);
+      void close_client_pipe(int client_idx);
+
+      //the provided buffer ring used for multishot client reads
+      io_uring_buf_ring *recv_buf_ring = nullptr;
+      std::vector<char> recv_buffers{}; //recv_buffer_count buffers of READ_SIZE, back to back
+      unsigned recv_buffers_in_ring = 0; //when this hits 0 reads fail with ENOBUFS, so we don't rearm them until it's non zero
+      std::vector<int> starved_reads{}; //client_idxs whose reads stopped because the ring ran dry
+      int current_read_buffer_id = -1; //the buffer used by the CQE currently being dealt with, -1 if none
+      bool current_read_buffer_held = false; //if true, the above isn't put back in the ring after the CQE
+
+      void setup_read_buffer_ring();
+      void recycle_read_buffer(int buffer_id); //gives a buffer back to the kernel
+      char *get_read_data(request *req); //where the data for the current read CQE is, either in the ring or the request
+
+      //plain writes, which send_data goes through for every non TLS client, and TLS clients whose records are done by the kernel (kTLS)
+      int add_write_req_continued(request *req, int offset); //only used for when writev didn't write everything
+      //writes as many of the items at the front of send_data as fit in IOV_MAX iovecs (stopping at a file), heads and data, with one writev
+      void add_gathered_write_req(int client_idx);
+      void prep_gathered_writev(request *req); //sets up the writev for whatever of the request's items is left after req->written
+
+      void write_front_item(int client_idx); //starts sending the item(s) at the front of the client's send_data
+      //pops the finished front items, starts on the next ones, and calls the write callback for each one
+      //if req was a zero copy write, the items are moved into it, since the kernel may not be done with them yet
+      void complete_front_items(int client_idx, size_t count, request *req = nullptr);
+      std::vector<int> completed_broadcast_info{}; //reused when items are completed, so it doesn't allocate each time
+      void plain_write_event(request *&req, int cqe_res); //deals with the completion of a plain WRITE, SPLICE_IN or SPLICE_OUT
+
+      io_uring_sqe *get_sqe(); //gets an SQE, submitting early only if the submission queue is full (submission normally happens once per loop in start())
+
       bool ran_server = false;
     private:
       int notification_efd = eventfd(0, 0); //used to awaken this thread for some event
@@ -197,13 +356,21 @@ namespace tcp_tls_server {
       static std::mutex init_mutex;
       static int shared_ring_fd; //pointer to a single io_uring ring fd, who's async backend is shared
     public:
-      server_base(int listen_port);
+      server_base(int listen_port, const server_settings &settings = server_settings());
       void start(); //function to start the server
 
       void read_connection(int client_idx);
 
+      //with multishot reads, the buffer given to the read callback goes back to the kernel once it returns, calling this from
+      //inside the read callback keeps it valid until release_read_buffer() is called with the returned ID
+      //returns -1 if the buffer isn't from the buffer ring, in which case copy whatever you need before returning
+      int hold_read_buffer();
+      void release_read_buffer(int buffer_id);
+
       //to read for a custom fd and be notified via the CUSTOM_READ event
-      void custom_read_req(int fd, size_t to_read, int client_idx = -1, std::vector<char> &&buff = {}, size_t read_amount = 0);
+      //reads to_read bytes of fd from file_offset, into buff after read_amount bytes, if it fails or hits the end of the fd first,
+      //the callback gets a shorter buff, with only what was read
+      void custom_read_req(int fd, size_t to_read, int client_idx = -1, std::vector<char> &&buff = {}, size_t read_amount = 0, size_t file_offset = 0);
 
       void notify_event();
       void kill_server(); // will kill the server
@@ -219,7 +386,7 @@ namespace tcp_tls_server {
       //this takes the request pointer by reference, since for now, we are still using some manual memory management
       void req_event_handler(request *&req, int cqe_res); //the main event handler
 
-      int add_write_req_continued(request *req, int offset); //only used for when writev didn't write everything
+      void flush_pending_writes(){} //plain writes are submitted as soon as they're made, so there's never anything to flush
       
       // for storing and accessing all of the non TLS servers on all threads
       static std::vector<server<server_type::NON_TLS>*> non_tls_servers;
@@ -232,20 +399,23 @@ namespace tcp_tls_server {
         read_callback<server_type::NON_TLS> r_cb = nullptr,
         write_callback<server_type::NON_TLS> w_cb = nullptr,
         event_callback<server_type::NON_TLS> e_cb = nullptr,
-        custom_read_callback<server_type::NON_TLS> cr_cb = nullptr
+        custom_read_callback<server_type::NON_TLS> cr_cb = nullptr,
+        const server_settings &settings = server_settings()
       );
 
       template<typename U>
       void broadcast_message(U begin, U end, int num_clients, std::vector<char> &&buff){
-        if(num_clients > 0){
-          auto data = new multi_write(std::move(buff), num_clients);
+        if(num_clients > 0)
+          broadcast_message(begin, end, num_clients, shared_buffer_namespace::shared_buffer(buff.data(), buff.size()));
+      }
 
-          for(auto client_idx_ptr = begin; client_idx_ptr != end; client_idx_ptr++){
-            auto &client = clients[(int)*client_idx_ptr];
-            client.send_data.emplace(data);
-            if(client.send_data.size() == 1) //only adds a write request in the case that the queue was empty before this
-              add_write_req(*client_idx_ptr, event_type::WRITE, &(data->buff[0]), data->buff.size());
-          }
+      template<typename U>
+      void broadcast_message(U begin, U end, int num_clients, const shared_buffer_namespace::shared_buffer &buff, uint64_t custom_info = 0){ //each client's write holds a reference to buff, so it stays valid until they're all done
+        for(auto client_idx_ptr = begin; client_idx_ptr != end; client_idx_ptr++){
+          auto &client = clients[(int)*client_idx_ptr];
+          client.send_data.emplace_back(buff, true, custom_info);
+          if(client.send_data.size() == 1) //only adds a write request in the case that the queue was empty before this, otherwise it's gathered into the next one
+            write_front_item(*client_idx_ptr);
         }
       }
 
@@ -254,34 +424,73 @@ namespace tcp_tls_server {
         if(num_clients > 0){
           for(auto client_idx_ptr = begin; client_idx_ptr != end; client_idx_ptr++){
             auto &client = clients[(int)*client_idx_ptr];
-            client.send_data.emplace(buff, length, true, custom_info);
+            client.send_data.emplace_back(buff, length, true, custom_info);
             if(client.send_data.size() == 1) //only adds a write request in the case that the queue was empty before this
-              add_write_req(*client_idx_ptr, event_type::WRITE, buff, length);
+              write_front_item(*client_idx_ptr);
           }
         }
       }
 
       static void kill_all_servers(); // will kill all non tls servers on any thread
 
+      bool is_early_data(int client_idx) const { return false; } //only TLS clients can send early data
+
       void write_connection(int client_idx, std::vector<char> &&buff); //writing depends on TLS or SSL, unlike read
-      void write_connection(int client_idx, char *buff, size_t length); //writing but using a char pointer, doesn't do anything to the data
+      //writing but using a char pointer, doesn't do anything to the data, if owner holds what the pointers point into, it's kept until the data is sent
+      void write_connection(int client_idx, const char *buff, size_t length, std::shared_ptr<const void> owner = nullptr);
+      //writes the head and then the data, without copying them into one buffer, the head pointer version trusts that it stays valid like the data
+      void write_connection(int client_idx, std::vector<char> &&head, const char *buff, size_t length, std::shared_ptr<const void> owner = nullptr);
+      void write_connection(int client_idx, const char *head, size_t head_length, const char *buff, size_t length, std::shared_ptr<const void> owner = nullptr);
+      //sends headers and then length bytes of file_fd from offset using splice, so the file never goes through user space
+      //takes ownership of file_fd if it returns true
+      bool write_file_connection(int client_idx, int file_fd, size_t offset, size_t length, std::vector<char> &&headers);
       void close_connection(int client_idx); //closing depends on what resources need to be freed
   };
 
   template<>
   class server<server_type::TLS>: public server_base<server_type::TLS> {
     private:
-      friend int tls_recv_helper(server<server_type::TLS> *tcp_server, int client_idx, char *buff, int sz, bool accept);
+      friend int tls_recv_helper(server<server_type::TLS> *tcp_server, int client_idx, char *buff, int sz);
       friend int tls_recv(WOLFSSL* ssl, char* buff, int sz, void* ctx);
       friend int tls_send(WOLFSSL* ssl, char* buff, int sz, void* ctx);
 
       friend class server_base;
       void tls_accept(int client_socket);
+
+      std::vector<char> plaintext{}; //what wolfSSL decrypts for the read callback, reused for every read, so it only grows
+      int decrypt_received(int client_idx); //decrypts all of the client's whole records into plaintext, returns how much was decrypted
+      //decrypts the early data the client has sent so far into plaintext, returns how much was decrypted, ended is set if the client
+      //has finished sending it (or never sent any), so the handshake can be finished
+      int read_early_data(int client_idx, bool &ended);
+      void continue_handshake(int client_idx); //carries on the handshake with what's been received, for clients which aren't active or sent early data
+
+      void send_new_item(int client_idx); //starts sending the item just added to send_data, if nothing before it is in the way
+      void encrypt_send_data(int client_idx); //gives send_data to wolfSSL in order, until TLS_OUTPUT_LIMIT bytes are waiting to be written
+      void queue_flush(int client_idx); //the client's tls_out is written at the end of this event loop iteration
+      void flush_pending_writes(); //called by the event loop once it's dealt with a batch of completions
+      std::vector<int> clients_to_flush{};
+
+      bool use_ktls = false; //from the settings, but false if fixed files are used
+      bool install_ktls_keys(int client_idx, int direction); //gives the kernel the session's keys for TLS_RX or TLS_TX, true if it took them
+      void start_ktls(int client_idx); //once the handshake's done, and wolfSSL has nothing left over from it
+      void finish_ktls(int client_idx); //switches sending to the kernel, once nothing encrypted by wolfSSL is waiting
+      //pops the send_data items whose records have all been written, encrypts more, and calls the write callback for each one
+      void complete_written_items(int client_idx);
       
       //this takes the request pointer by reference, since for now, we are still using some manual memory management
       void req_event_handler(request *&req, int cqe_res); //the main event handler
 
-      WOLFSSL_CTX *wolfssl_ctx = nullptr;
+      //one context for every thread, replaced when the certificates are reloaded, so it's only read and written with std::atomic_load/store,
+      //wolfSSL_new takes its own reference to the context, so sessions made with the old one carry on, and it's freed after the last of them
+      static std::shared_ptr<WOLFSSL_CTX> wolfssl_ctx;
+      static std::mutex wolfssl_ctx_lock; //held while a context is made, so the certificates are only loaded by one thread at once
+      static std::string fullchain_path;
+      static std::string pkey_path;
+      static server_settings ctx_settings; //the first TLS server's, every thread is given the same TLS settings
+      static WOLFSSL_CTX *make_wolfssl_ctx(const char *&error); //loads the certificate files into a new context, null (with error set) if it can't
+
+      static ticket_key_store ticket_keys; //shared by every thread, so a session can be resumed on any of them
+      static session_stats stats;
 
       // for storing and accessing all of the TLS servers on all threads
       static std::vector<server<server_type::TLS>*> tls_servers;
@@ -297,20 +506,22 @@ namespace tcp_tls_server {
         read_callback<server_type::TLS> r_cb = nullptr,
         write_callback<server_type::TLS> w_cb = nullptr,
         event_callback<server_type::TLS> e_cb = nullptr,
-        custom_read_callback<server_type::TLS> cr_cb = nullptr
+        custom_read_callback<server_type::TLS> cr_cb = nullptr,
+        const server_settings &settings = server_settings()
       );
       
       template<typename U>
       void broadcast_message(U begin, U end, int num_clients, std::vector<char> &&buff){
-        if(num_clients > 0){
-          auto data = new multi_write(std::move(buff), num_clients);
+        if(num_clients > 0)
+          broadcast_message(begin, end, num_clients, shared_buffer_namespace::shared_buffer(buff.data(), buff.size()));
+      }
 
-          for(auto client_idx_ptr = begin; client_idx_ptr != end; client_idx_ptr++){
-            auto &client = clients[(int)*client_idx_ptr];
-            client.send_data.emplace(data);
-            if(client.send_data.size() == 1) //only adds a write request in the case that the queue was empty before this
-              wolfSSL_write(client.ssl, &(data->buff[0]), data->buff.size());
-          }
+      template<typename U>
+      void broadcast_message(U begin, U end, int num_clients, const shared_buffer_namespace::shared_buffer &buff, uint64_t custom_info = 0){ //each client's write holds a reference to buff, so it stays valid until they're all done
+        for(auto client_idx_ptr = begin; client_idx_ptr != end; client_idx_ptr++){
+          auto &client = clients[(int)*client_idx_ptr];
+          client.send_data.emplace_back(buff, true, custom_info);
+          send_new_item(*client_idx_ptr);
         }
       }
 
@@ -319,17 +530,30 @@ namespace tcp_tls_server {
         if(num_clients > 0){
           for(auto client_idx_ptr = begin; client_idx_ptr != end; client_idx_ptr++){
             auto &client = clients[(int)*client_idx_ptr];
-            client.send_data.emplace(buff, length, true, custom_info);
-            if(client.send_data.size() == 1) //only adds a write request in the case that the queue was empty before this
-              wolfSSL_write(client.ssl, buff, length);
+            client.send_data.emplace_back(buff, length, true, custom_info);
+            send_new_item(*client_idx_ptr);
           }
         }
       }
 
       static void kill_all_servers(); // will kill all tls servers on any thread
+      static const session_stats &get_session_stats(){ return stats; } //for every TLS server thread
+      //loads the certificate files again, new handshakes on every thread use them from now on, and connections already made are unaffected
+      //false if they couldn't be loaded (i.e only one of them has been replaced so far), in which case the old ones are kept, it's safe to call from any thread
+      static bool reload_certificates();
+
+      //if what the read callback has been given is early data, which an attacker could have recorded and sent again,
+      //so it should only be acted on if doing it twice is harmless (i.e a GET)
+      bool is_early_data(int client_idx) const { return clients[client_idx].early_data; }
 
       void write_connection(int client_idx, std::vector<char> &&buff); //writing depends on TLS or SSL, unlike read
-      void write_connection(int client_idx, char *buff, size_t length); //writing but using a char pointer, doesn't do anything to the data
+      //writing but using a char pointer, doesn't do anything to the data, if owner holds what the pointers point into, it's kept until the data is sent
+      void write_connection(int client_idx, const char *buff, size_t length, std::shared_ptr<const void> owner = nullptr);
+      //writes the head and then the data, without copying them into one buffer, the head pointer version trusts that it stays valid like the data
+      void write_connection(int client_idx, std::vector<char> &&head, const char *buff, size_t length, std::shared_ptr<const void> owner = nullptr);
+      void write_connection(int client_idx, const char *head, size_t head_length, const char *buff, size_t length, std::shared_ptr<const void> owner = nullptr);
+      //only kTLS clients can have a file spliced to them, otherwise it has to be encrypted in user space, so this returns false, and the fd is left for the caller
+      bool write_file_connection(int client_idx, int file_fd, size_t offset, size_t length, std::vector<char> &&headers);
       void close_connection(int client_idx); //closing depends on what resources need to be freed
   };
 
@@ -2,6 +2,7 @@
 #define SERVER_ENUMS
 
 #include <vector> //for vectors
+#include <cstddef> //for size_t
 
 enum class server_type { TLS, NON_TLS };
 
@@ -9,11 +10,47 @@ enum class server_type { TLS, NON_TLS };
 constexpr int QUEUE_DEPTH = 256; //the maximum number of events which can be submitted to the io_uring submission queue ring at once, you can have many more pending requests though
 
 namespace tcp_tls_server {
-  enum class event_type{ ACCEPT, ACCEPT_READ, ACCEPT_WRITE, READ, WRITE, NOTIFICATION, CUSTOM_READ, TIMERFD, KILL };
+  enum class event_type{ ACCEPT, ACCEPT_READ, ACCEPT_WRITE, READ, WRITE, NOTIFICATION, CUSTOM_READ, TIMERFD, KILL, SPLICE_IN, SPLICE_OUT, CLOSE };
 
-  constexpr int BACKLOG = 10; //max number of connections pending acceptance
+  constexpr int BACKLOG = 10; //default max number of connections pending acceptance
   constexpr int READ_SIZE = 8192; //how much one read request should read
   constexpr int READ_BLOCK_SIZE = 8192; //how much to read from a file at once
+  constexpr int SPLICE_CHUNK_SIZE = 65536; //how much of a file is spliced through a client's pipe at once (this is also the pipe size)
+  constexpr int RECV_BUFFER_GROUP = 0; //the buffer group ID of the provided buffer ring used for client reads
+  constexpr int CQE_BATCH_SIZE = QUEUE_DEPTH; //the most completions dealt with in one pass of the event loop
+  constexpr unsigned DEFAULT_CQE_WAIT_TIMEOUT_US = 1000; //how long to wait for a batch of completions if no timeout is given
+  constexpr size_t TLS_OUTPUT_LIMIT = 262144; //how many encrypted bytes a TLS client can have waiting to be written before no more of its send_data is encrypted
+
+  //when the work the kernel does for completions (i.e copying received data) is run on the server's thread
+  //DEFAULT interrupts the thread whenever a completion is ready, COOP waits until it next goes into the kernel (needs kernel >= 5.19),
+  //DEFER only runs it when the thread waits for completions, so a whole batch is done at once (needs kernel >= 6.1, implies single_issuer, and can't be used with sqpoll)
+  enum class task_run { DEFAULT, COOP, DEFER };
+
+  struct server_settings { //optional tuning for the TCP/TLS server, everything defaults to the original behaviour
+    unsigned cqe_wait_nr = 1; //minimum number of completions to wait for before running the event loop
+    unsigned cqe_wait_timeout_us = 0; //only used if cqe_wait_nr > 1, how long to wait for those completions before running anyway
+    int backlog = BACKLOG; //max number of connections pending acceptance (the kernel caps this at net.core.somaxconn)
+    bool multishot_accept = false; //one accept request stays armed for every new connection (needs kernel >= 5.19)
+    bool multishot_recv = false; //non TLS client reads use a multishot recv and a shared ring of provided buffers (needs kernel >= 5.19)
+    unsigned recv_buffer_count = 512; //number of READ_SIZE buffers in the provided buffer ring, must be a power of 2
+    size_t zero_copy_threshold = 0; //non TLS writes of at least this many bytes use zero copy sends (needs kernel >= 6.1), 0 turns them off
+    //if not 0, client sockets are accepted straight into a table of this many files registered with the ring, so the kernel doesn't
+    //look the socket up for every request, it's the most connections a thread can have open at once (needs kernel >= 5.19)
+    unsigned fixed_files = 0;
+    bool sqpoll = false; //a kernel thread polls the submission queue, so submitting doesn't need a syscall while it's busy (needs root before kernel 5.11)
+    unsigned sq_thread_idle_ms = 0; //how long the polling thread spins without work before it sleeps, 0 is the kernel's default of 1s
+    int sq_thread_cpu = -1; //the CPU the polling thread is pinned to, -1 lets it run anywhere
+    bool single_issuer = false; //only the thread which made the ring submits to it, which lets the kernel skip some locking (needs kernel >= 6.0)
+    task_run taskrun = task_run::DEFAULT;
+    //TLS connections give their keys to the kernel once the handshake's done, so they're read and written like plain ones, files included
+    //(needs the tls kernel module, and can't be used with fixed_files, since the keys are set with setsockopt)
+    bool ktls = false;
+    //TLS clients are given session tickets, encrypted with a key shared by every thread, so their next connection to any thread is resumed
+    bool session_tickets = false;
+    //how many bytes a client resuming its session can send with the handshake (0-RTT early data), 0 turns it off, needs session_tickets
+    //early data can be replayed by an attacker, so is_early_data() says if it's what the read callback has been given
+    unsigned max_early_data = 0;
+  };
 
   template<server_type T>
   class server_base; //forward declaration
@@ -0,0 +1,49 @@
+#ifndef SESSION_TICKETS
+#define SESSION_TICKETS
+
+#include <wolfssl/options.h>
+#include <wolfssl/ssl.h>
+
+#include <mutex>
+#include <atomic>
+#include <ctime>
+#include <cstdint>
+
+namespace tcp_tls_server {
+  constexpr time_t TICKET_KEY_LIFETIME = 3600; //how many seconds a ticket key is used for, tickets it made are accepted for the same time again after that
+  constexpr int TICKET_KEY_SIZE = 32; //ChaCha20-Poly1305
+
+  //the keys session tickets are encrypted with, shared by every TLS server thread, so a client can resume on whichever thread
+  //it connects to next, the key is replaced once it's TICKET_KEY_LIFETIME old, and the one before it is kept,
+  //so tickets it made still work until they would have expired anyway
+  class ticket_key_store {
+  public:
+    struct ticket_key {
+      unsigned char name[WOLFSSL_TICKET_NAME_SZ]; //sent in the clear with the ticket, so the right key can be found for it
+      unsigned char key[TICKET_KEY_SIZE];
+      time_t created{};
+    };
+
+    bool encryption_key(ticket_key &key); //the current key, making a new one if it's too old, false if no random key could be made
+    //the key a ticket was made with, renew is set if it's the previous key, so the client should be given a new ticket
+    bool decryption_key(const unsigned char *name, ticket_key &key, bool &renew);
+  private:
+    std::mutex lock{};
+    ticket_key current{};
+    ticket_key previous{};
+    bool has_current = false;
+    bool has_previous = false;
+  };
+
+  //wolfSSL's ticket callback, ctx is the ticket_key_store, the ticket is encrypted in place, with the key's name and the IV authenticated along with it
+  int ticket_encryption_cb(WOLFSSL *ssl, unsigned char key_name[WOLFSSL_TICKET_NAME_SZ], unsigned char iv[WOLFSSL_TICKET_IV_SZ],
+    unsigned char mac[WOLFSSL_TICKET_MAC_SZ], int enc, unsigned char *ticket, int in_length, int *out_length, void *ctx);
+
+  struct session_stats { //counted by every TLS server thread, to see how many clients are resuming their sessions
+    std::atomic<uint64_t> full_handshakes{};
+    std::atomic<uint64_t> resumed_handshakes{};
+    std::atomic<uint64_t> early_data_handshakes{}; //resumed handshakes which the client sent a request with (0-RTT)
+  };
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef SHARED_BUFFER
+#define SHARED_BUFFER
+
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <new>
+
+// An immutable buffer with its reference count in the same allocation as its data, so copying one is a single atomic increment.
+// Copies can be held and dropped on any thread, and whichever drops the last one frees it, so data written to lots of clients
+// (possibly on several threads, i.e broadcasts) is freed once the last write of it is done, without anyone counting the writes.
+// A copy itself isn't thread safe, each thread should have its own.
+
+namespace shared_buffer_namespace {
+  class shared_buffer {
+    struct header {
+      std::atomic<uint32_t> refs;
+      size_t length;
+    };
+    header *block = nullptr; // the data is straight after the header
+
+    void release(){
+      if(block && block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1){ // the last reference, so nothing else can see it
+        block->~header();
+        ::operator delete(block);
+      }
+      block = nullptr;
+    }
+
+  public:
+    shared_buffer() {}
+    shared_buffer(const char *data, size_t length) : block(static_cast<header*>(::operator new(sizeof(header) + length))) {
+      new (block) header();
+      block->refs.store(1, std::memory_order_relaxed);
+      block->length = length;
+      if(length)
+        std::memcpy(reinterpret_cast<char*>(block + 1), data, length);
+    }
+
+    shared_buffer(const shared_buffer &other) : block(other.block) {
+      if(block)
+        block->refs.fetch_add(1, std::memory_order_relaxed); // whoever copies it already has a reference, so it can't be freed meanwhile
+    }
+    shared_buffer(shared_buffer &&other) : block(other.block) {
+      other.block = nullptr;
+    }
+
+    shared_buffer &operator=(const shared_buffer &other){
+      if(other.block)
+        other.block->refs.fetch_add(1, std::memory_order_relaxed); // before releasing, in case they're the same block
+      release();
+      block = other.block;
+      return *this;
+    }
+    shared_buffer &operator=(shared_buffer &&other){
+      if(this != &other){
+        release();
+        block = other.block;
+        other.block = nullptr;
+      }
+      return *this;
+    }
+
+    ~shared_buffer(){
+      release();
+    }
+
+    const char *data() const { return block ? reinterpret_cast<const char*>(block + 1) : nullptr; }
+    size_t size() const { return block ? block->length : 0; }
+    explicit operator bool() const { return block; }
+  };
+}
+
+#endif
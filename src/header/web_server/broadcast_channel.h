@@ -0,0 +1,135 @@
+#ifndef BROADCAST_CHANNEL
+#define BROADCAST_CHANNEL
+
+#include <atomic>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <cstdint>
+#include <thread>
+
+#include "../shared_buffer.h"
+
+namespace web_server {
+  constexpr uint64_t BROADCAST_RING_SIZE = 1024; //how many frames can be waiting for the slowest server thread, must be a power of 2
+
+  //a frame sent to every server thread, each client's write holds a reference until it's done,
+  //so it's freed by whichever thread finishes with it last, without telling the central thread
+  using broadcast_frame = shared_buffer_namespace::shared_buffer;
+
+  //frames are published by one thread (the central thread) into a ring which all of the server threads read from, each at its own position,
+  //a thread is only woken if it's drained the ring since it was last woken, so a burst of broadcasts costs at most one
+  //wakeup per thread, and it then deals with all of them at once
+  //consumers are added by the server threads, only publish and flush are called on the central thread
+  class broadcast_channel {
+    struct consumer {
+      std::atomic<uint64_t> position{}; //the sequence number of the next frame it'll read
+      std::atomic<bool> notified{}; //if it's been woken up and hasn't drained the ring since
+      std::atomic<bool> active{}; //set once wake and position are, so the producer ignores it until then
+      std::atomic<bool> joining{}; //set before it reads head, so the producer doesn't free frames it could be about to start from
+      std::atomic<bool> waking{}; //set by the producer around calling wake, so remove_consumer can wait until it's done
+      std::function<void()> wake{}; //i.e the server's notify_event(), called on the producer's thread
+    };
+
+    std::unique_ptr<broadcast_frame[]> ring{new broadcast_frame[BROADCAST_RING_SIZE]};
+    std::unique_ptr<consumer[]> consumers{};
+    int max_consumers{};
+    std::atomic<int> num_consumers{};
+
+    std::atomic<uint64_t> head{}; //the sequence number of the next frame to be published
+    uint64_t tail{}; //the oldest frame still held by the ring, only used by the producer
+    std::deque<broadcast_frame> backlog{}; //frames waiting for room in the ring, only used by the producer
+
+    uint64_t slowest_position(){ //where the furthest behind consumer is, only the producer calls this
+      uint64_t slowest = head.load(std::memory_order_relaxed);
+      //seq_cst, paired with add_consumer, so either a new consumer is seen here, or it reads a head at least as new as the one above
+      const int count = num_consumers.load(std::memory_order_seq_cst);
+      for(int i = 0; i < count && i < max_consumers; i++){
+        if(consumers[i].joining.load(std::memory_order_seq_cst)) //its position isn't known yet, so nothing is freed this time
+          return tail;
+        if(!consumers[i].active.load(std::memory_order_acquire)) continue;
+        const auto position = consumers[i].position.load(std::memory_order_acquire);
+        if(position < slowest)
+          slowest = position;
+      }
+      return slowest;
+    }
+  public:
+    void set_max_consumers(int count){ //call before any consumers are added
+      consumers.reset(new consumer[count]);
+      max_consumers = count;
+    }
+
+    int add_consumer(std::function<void()> wake){ //returns the consumer's idx for drain, or -1 if there are already max_consumers, it only gets frames published after this
+      const int idx = num_consumers.fetch_add(1);
+      if(idx >= max_consumers)
+        return -1;
+
+      auto &c = consumers[idx];
+      c.wake = std::move(wake);
+      c.joining.store(true, std::memory_order_seq_cst); //before head is read, so the producer can't free anything from there on meanwhile
+      c.position.store(head.load(std::memory_order_seq_cst), std::memory_order_relaxed);
+      c.active.store(true, std::memory_order_release);
+      c.joining.store(false, std::memory_order_release);
+      return idx;
+    }
+
+    //after this returns the consumer's wake won't be called, and it doesn't hold back frames being freed, so whatever wake uses can be destroyed
+    void remove_consumer(int consumer_idx){
+      auto &c = consumers[consumer_idx];
+      c.active.store(false, std::memory_order_seq_cst);
+      while(c.waking.load(std::memory_order_seq_cst)) //seq_cst with flush, so either it sees it's inactive, or this waits for its wake to finish
+        std::this_thread::yield();
+    }
+
+    void publish(broadcast_frame frame){ //queues the frame for every consumer, and wakes the ones which aren't already awake
+      backlog.push_back(std::move(frame));
+      flush();
+    }
+
+    //moves as many waiting frames into the ring as fit, frames only wait if a thread is BROADCAST_RING_SIZE frames behind,
+    //in which case they're tried again on the next publish or flush
+    void flush(){
+      const auto slowest = slowest_position();
+      for(; tail < slowest; tail++) //every consumer is past these, so the ring's references are dropped
+        ring[tail & (BROADCAST_RING_SIZE - 1)] = broadcast_frame();
+
+      auto position = head.load(std::memory_order_relaxed);
+      const auto start = position;
+      while(backlog.size() && position - slowest < BROADCAST_RING_SIZE){
+        ring[position & (BROADCAST_RING_SIZE - 1)] = std::move(backlog.front());
+        backlog.pop_front();
+        position++;
+      }
+      if(position == start)
+        return;
+      head.store(position, std::memory_order_seq_cst); //seq_cst for add_consumer, see slowest_position
+
+      const int count = num_consumers.load(std::memory_order_acquire);
+      for(int i = 0; i < count && i < max_consumers; i++){
+        auto &c = consumers[i];
+        c.waking.store(true, std::memory_order_seq_cst);
+        if(c.active.load(std::memory_order_seq_cst) && !c.notified.exchange(true, std::memory_order_acq_rel)) //already awake ones will see these frames when they drain
+          c.wake();
+        c.waking.store(false, std::memory_order_release);
+      }
+    }
+
+    //calls handle_frame with each frame the consumer hasn't seen yet, on the consumer's thread, the frame reference is only valid
+    //during the call, so copy it to keep it
+    template<typename F>
+    void drain(int consumer_idx, F &&handle_frame){
+      auto &c = consumers[consumer_idx];
+      c.notified.exchange(false, std::memory_order_acq_rel); //before reading head, so anything published after this wakes it again
+
+      auto position = c.position.load(std::memory_order_relaxed);
+      const auto end = head.load(std::memory_order_acquire);
+      for(; position != end; position++)
+        handle_frame(ring[position & (BROADCAST_RING_SIZE - 1)]);
+
+      c.position.store(position, std::memory_order_release); //only now can the producer reuse those slots
+    }
+  };
+}
+
+#endif
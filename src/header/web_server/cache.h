@@ -1,180 +1,176 @@
 #ifndef CACHE
 #define CACHE
 
-#include <unordered_set>
 #include <unordered_map>
+#include <unordered_set>
+#include <list>
 #include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <array>
+#include <queue>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <ctime>
 
 #include <sys/inotify.h>
-
-#include "common_structs_enums.h"
+#include <sys/mman.h>
+#include <unistd.h>
 
 namespace web_cache {
-  struct cache_item {
-    std::vector<char> buffer{};
-    int lock_number{}; //number of times this has been locked, if non zero then this item should NOT be removed (in use)
-    int next_item_idx = -1;
-    int prev_item_idx = -1;
-    bool outdated = false; //if true, then removed from cache
-    int watch{};
+  constexpr int CACHE_SHARDS = 8; //files are spread over this many separately locked parts of the cache, by the hash of their path
+  constexpr size_t DEFAULT_CACHE_SIZE = 64 << 20; //in bytes, used if CACHE_SIZE isn't in the config
+  constexpr int PROTECTED_PERCENT = 80; //how much of a shard can be used by items which have been requested more than once
+  constexpr size_t INOTIFY_READ_SIZE = 4096; //how much is read from the inotify fd at once, enough for lots of events
+  constexpr size_t HUGE_PAGE_SIZE = 2 << 20; //mappings at least this big are asked to use transparent huge pages, to cut TLB misses
+  constexpr int MAX_COMPRESSED_PERCENT = 90; //a compressed copy which is bigger than this much of the original isn't worth keeping
+
+  enum head_type { OK_KEEP_ALIVE, OK_CLOSE, NOT_MODIFIED_KEEP_ALIVE, NOT_MODIFIED_CLOSE, NUM_HEAD_TYPES }; //the responses whose headers are kept with a file
+
+  enum content_encoding { IDENTITY, BROTLI, ZSTD, GZIP, NUM_ENCODINGS }; //what a file's data is compressed with
+  constexpr int encoding_bit(content_encoding encoding) { return 1 << encoding; } //for sets of encodings
+
+  struct file_info { //what the response headers need to know about a file
+    size_t size{}; //of the whole file, even if only part of it is held
+    std::string etag{}; //i.e "1a2b-3c4d-5e6f", including the quotes
+    time_t modified_time{};
+    std::string last_modified{}; //modified_time as an HTTP date, i.e Wed, 21 Oct 2015 07:28:00 GMT
+    const char *content_type = nullptr; //the whole Content-Type header line
+    content_encoding encoding = IDENTITY;
+    int precompressed{}; //encoding_bits of the compressed copies of the file next to it (i.e index.html.br), found when it was read
   };
 
-  struct cache_fetch_item {
-    cache_fetch_item(bool found, char *buff_ptr, size_t size = -1) : found(found), buff(buff_ptr), size(size) {}
-    bool found = false;
-    size_t size{};
-    char *buff{};
-  };
+  enum class cache_backend { HEAP, MMAP }; //whether files are read into memory, or mapped
 
-  template<int N>
-  class cache{
-  private:
-    std::unordered_map<std::string, int> filepath_to_cache_idx{};
-    std::unordered_map<int, std::string> cache_idx_to_filepath{};
-    std::array<cache_item, N> cache_buffer{};
-    std::unordered_set<int> free_idxs{}; //only used at the beginning of the program, and when files are modified
-    std::unordered_map<int, int> client_idx_to_cache_idx{}; //used in setting/unsetting locks
-    int highest_idx = -1;
-    int lowest_idx = -1;
-
-    std::unordered_map<int, int> watch_to_cache_idx{};
+  //the data of a cached file, either read into memory, or the file mapped read only, which is shared with the page cache,
+  //so it's never copied, and only takes up memory once however many threads (or processes) are sending it
+  //if a mapped file is truncated, reading past its new end would raise SIGBUS, so the handler for that maps zeroed pages over what's gone,
+  //what's being sent is wrong anyway since the file changed, and the entry is evicted once its inotify event is dealt with
+  class file_body {
+    std::vector<char> buffer{};
+    void *mapping = nullptr;
+    size_t mapped_length{};
+    void unmap();
   public:
-    const int inotify_fd = inotify_init(); //public as we need to read from it
+    file_body(std::vector<char> &&buffer = {}) : buffer(std::move(buffer)) {}
+    static file_body map_file(int file_fd, size_t length); //is_mapped() is false if it couldn't be mapped
 
-    cache(){ //only works for cache's which are greater than 1 in size
-      for(int i = 0; i < cache_buffer.size(); i++)
-        free_idxs.insert(i);
+    file_body(const file_body&) = delete;
+    file_body(file_body &&other) : buffer(std::move(other.buffer)), mapping(other.mapping), mapped_length(other.mapped_length) {
+      other.mapping = nullptr;
     }
 
-    cache_fetch_item fetch_item(const std::string &filepath, int client_idx, web_server::tcp_client &client){
-      if(filepath_to_cache_idx.count(filepath)) {
-        auto current_idx = filepath_to_cache_idx[filepath];
-        auto &item = cache_buffer[current_idx];
-
-        client.using_file = true; //we are using a file, we have incremented the lock number once
-        cache_buffer[current_idx].lock_number++;
-
-        client_idx_to_cache_idx[client_idx] = current_idx; //mapping to the idx that the client_idx is locking
-
-        bool outdated_file = item.outdated;
-
-        if(item.next_item_idx == -1){ //cannot promote highest one more
-          if(!outdated_file){
-            return { true, &(cache_buffer[current_idx].buffer[0]), cache_buffer[current_idx].buffer.size() };
-          }else{ //file is outdated
-            if(item.prev_item_idx != -1)
-              cache_buffer[item.prev_item_idx].next_item_idx = -1;
-            
-            inotify_rm_watch(inotify_fd, item.watch); //remove the watcher for this item
-            watch_to_cache_idx.erase(item.watch);
-            free_idxs.insert(current_idx);
-            item = cache_item();
-
-            return { false, nullptr };
-          }
-        }
-        
-        //otherwise promote current item to top
-
-        if(item.prev_item_idx != -1){ //first though we've gotta remove it from its current position
-          auto &prev_item = cache_buffer[item.prev_item_idx];
-          auto &next_item = cache_buffer[item.next_item_idx];
-          prev_item.next_item_idx = item.next_item_idx;
-          next_item.prev_item_idx = item.prev_item_idx;
-        }else{
-          auto &next_item = cache_buffer[item.next_item_idx];
-          next_item.prev_item_idx = -1;
-          lowest_idx = item.next_item_idx;
-        }
-
-        if(outdated_file){
-          inotify_rm_watch(inotify_fd, item.watch); //remove the watcher for this item
-          watch_to_cache_idx.erase(item.watch);
-          free_idxs.insert(current_idx);
-          item = cache_item();
-
-          return { false, nullptr };
-        }
-
-        cache_buffer[highest_idx].next_item_idx = current_idx;
-        cache_buffer[current_idx].next_item_idx = -1;
-        cache_buffer[current_idx].prev_item_idx = highest_idx;
-
-        highest_idx = current_idx; //current item is promoted to the top
-
-        return { true, &(cache_buffer[current_idx].buffer[0]), cache_buffer[current_idx].buffer.size() };
-      }else{
-        return { false, nullptr };
-      }
-    }
-    
-    bool try_insert_item(int client_idx, const std::string &filepath, std::vector<char> &&buff){
-      int current_idx = -1;
-
-      if(free_idxs.size()){ //if free idxs available
-        current_idx = *free_idxs.cbegin();
-        free_idxs.erase(current_idx);
-
-        if(lowest_idx == -1)
-          lowest_idx = current_idx;
-      }else{
-        auto &lowest_item = cache_buffer[lowest_idx];
-
-        if(!lowest_item.lock_number){ //only if the lock_number is 0, then this item can be inserted in place of the old one (otherwise the old one is still in use)
-          const auto new_lowest_idx = lowest_item.next_item_idx;
-
-          cache_buffer[lowest_item.next_item_idx].prev_item_idx = -1; //2nd lowest is now lowest
-          inotify_rm_watch(inotify_fd, lowest_item.watch); //remove the watcher for this item
-          watch_to_cache_idx.erase(lowest_item.watch);
-          cache_buffer[lowest_idx] = cache_item(); //we are reusing the lowest item
-
-          filepath_to_cache_idx.erase(cache_idx_to_filepath[lowest_idx]);
-          cache_idx_to_filepath.erase(lowest_idx);
-          
-          current_idx = lowest_idx;
-          lowest_idx = new_lowest_idx;
-        }
-      }
+    const char *data() const { return mapping ? (const char*)mapping : buffer.data(); }
+    size_t size() const { return mapping ? mapped_length : buffer.size(); }
+    bool is_mapped() const { return mapping; }
 
-      if(current_idx != -1){
-        auto &current_item = cache_buffer[current_idx];
-        
-        if(highest_idx != -1)
-          cache_buffer[highest_idx].next_item_idx = current_idx;
-        
-        filepath_to_cache_idx[filepath] = current_idx;
-        cache_idx_to_filepath[current_idx] = filepath;
-
-        current_item.watch = inotify_add_watch(inotify_fd, filepath.c_str(), IN_MODIFY);
-        watch_to_cache_idx[current_item.watch] = current_idx;
-
-        current_item.prev_item_idx = highest_idx; //promote to highest
-        current_item.next_item_idx = -1;
-        highest_idx = current_idx; //new highest position
-        current_item.buffer = std::move(buff); //populate the buffer
-        return true;
-      }else{
-        return false;
-      }
+    ~file_body(){
+      if(mapping)
+        unmap();
     }
-      
-    void inotify_event_handler(int watch){ //we are only monitoring for events which outdate files we are monitoring
-      if(watch_to_cache_idx.count(watch)){
-        const auto cache_idx = watch_to_cache_idx[watch];
-        if(cache_idx < cache_buffer.size()){
-          cache_buffer[cache_idx].outdated = true;
-        }
-      }
+  };
+
+  struct cache_entry { //never changed once it's made, so any thread can read it without a lock
+    cache_entry(file_body &&body, file_info &&info, std::array<std::string, NUM_HEAD_TYPES> &&heads) :
+      body(std::move(body)), info(std::move(info)), heads(std::move(heads)) {}
+    const file_body body; //the file
+    const file_info info;
+    //the full response headers for the usual responses (the whole file with a 200, or a 304), indexed by head_type,
+    //made once when it's cached, so those responses are sent without formatting or allocating anything
+    const std::array<std::string, NUM_HEAD_TYPES> heads;
+
+    size_t size() const { //what it counts for in the cache
+      size_t total = body.size() + info.etag.size() + info.last_modified.size();
+      for(const auto &head : heads)
+        total += head.size();
+      return total;
     }
+  };
+
+  //whoever is sending an entry holds one of these until it's written, so removing it from the cache never has to wait
+  using cache_entry_ptr = std::shared_ptr<const cache_entry>;
+
+  //makes the entry for the compressed copy of a file, given the compressed data and the original's info, called on the compression thread
+  using make_compressed_entry = std::function<cache_entry_ptr(file_body &&compressed, const file_info &original)>;
+
+  //a file cache shared by all of the server threads, limited by the number of bytes it holds
+  //each shard uses a segmented LRU, new items go into probation, and are moved to the protected segment if they're requested again,
+  //so files which are only requested once can't push out the ones used all the time
+  class cache {
+    struct cache_node {
+      cache_entry_ptr entry{};
+      cache_entry_ptr compressed{}; //a gzipped copy of entry, made on the compression thread some time after it's cached
+      size_t size() const { return entry->size() + (compressed ? compressed->size() : 0); }
+      std::list<const std::string*>::iterator position{}; //where it is in its segment's list
+      bool is_protected = false;
+      int watch = -1;
+    };
+
+    using node_map = std::unordered_map<std::string, cache_node>;
+
+    struct shard {
+      std::mutex lock{};
+      node_map items{};
+      std::list<const std::string*> probation{}; //keys of items, most recently used at the front
+      std::list<const std::string*> protected_items{};
+      size_t probation_bytes{};
+      size_t protected_bytes{};
+    };
+
+    std::array<shard, CACHE_SHARDS> shards{};
+    size_t shard_capacity = DEFAULT_CACHE_SIZE / CACHE_SHARDS;
+    cache_backend backend = cache_backend::HEAP;
+
+    std::mutex watch_lock{}; //always taken after a shard's lock, if both are needed
+    std::unordered_map<int, std::unordered_set<std::string>> watch_to_filepaths{}; //a file has one watch however many paths reach it
+
+    struct compress_job {
+      std::string filepath{};
+      cache_entry_ptr entry{};
+      make_compressed_entry make_entry{};
+    };
+
+    //compression is slow, so it's done on its own thread, rather than blocking whichever server thread cached the file
+    std::thread compress_thread{};
+    std::mutex compress_lock{};
+    std::condition_variable compress_cv{};
+    std::queue<compress_job> compress_jobs{};
+    bool stop_compressing = false;
+
+    void compress_worker();
+    void insert_compressed(const std::string &filepath, const cache_entry_ptr &entry, const cache_entry_ptr &compressed);
+
+    shard &get_shard(const std::string &filepath);
+    void remove_node(shard &s, node_map::iterator node_it); //the shard must be locked
+    void promote(shard &s, cache_node &node); //the shard must be locked
+  public:
+    const int inotify_fd = inotify_init1(IN_CLOEXEC); //public as whoever owns the cache needs to read from it, and pass the events to inotify_event_handler
+
+    void set_capacity(size_t bytes); //only call this before the cache is used
+    void set_backend(cache_backend new_backend){ backend = new_backend; } //same for this
+    cache_backend get_backend() const { return backend; }
+
+    //null if it isn't cached, if compressed isn't null it's set to the gzipped copy of the file, if there is one yet
+    cache_entry_ptr fetch_item(const std::string &filepath, cache_entry_ptr *compressed = nullptr);
+    bool insert_item(const std::string &filepath, const cache_entry_ptr &entry); //caches the entry if it fits, evicting whatever is needed, returns if it was cached
+    //gzips a cached entry on the compression thread, and keeps the result with it (if it's still cached, and the result is small enough)
+    void compress_item(const std::string &filepath, const cache_entry_ptr &entry, make_compressed_entry make_entry);
+
+    void inotify_event_handler(const char *events, size_t length); //removes any items whose files have changed
 
-    void finished_with_item(int client_idx, web_server::tcp_client &client){ //requires a pointer to the client object, for the using_file stuff - to ensure it's not decremented too many times
-      if(client.using_file){
-        const auto cache_idx = client_idx_to_cache_idx[client_idx];
-        cache_buffer[cache_idx].lock_number--;
-        client.using_file = false;
+    ~cache(){
+      {
+        std::lock_guard<std::mutex> guard(compress_lock);
+        stop_compressing = true;
       }
+      compress_cv.notify_one();
+      if(compress_thread.joinable())
+        compress_thread.join();
+      close(inotify_fd);
     }
   };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,31 @@
+#ifndef CERTIFICATE_WATCHER
+#define CERTIFICATE_WATCHER
+
+#include <string>
+#include <vector>
+#include <thread>
+
+namespace web_server {
+  constexpr int CERTIFICATE_SETTLE_MS = 1000; //how long to wait after the certificate files change before loading them, so a renewal which replaces both is loaded once
+
+  //reloads the TLS certificates on its own thread whenever the files change, or the process is sent SIGHUP, new handshakes use the new ones,
+  //and existing connections (i.e websockets) carry on with the old ones
+  //the directories the files are in are watched rather than the files, since they're usually symlinks (i.e certbot's), which renewal points somewhere else
+  class certificate_watcher {
+    std::thread watch_thread{};
+    int inotify_fd = -1;
+    int signal_fd = -1;
+    int stop_efd = -1;
+    std::vector<std::string> file_names{}; //what's watched in those directories
+
+    void watch_directory(const std::string &path);
+    void watch(); //runs on watch_thread
+  public:
+    //SIGHUP is blocked on the calling thread, so it must be called before any other threads are started, so they all inherit that,
+    //and it's only ever delivered to the watcher
+    void start(const std::string &fullchain_path, const std::string &pkey_path);
+    ~certificate_watcher();
+  };
+}
+
+#endif
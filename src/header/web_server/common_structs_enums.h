@@ -2,12 +2,29 @@
 #define COMMON_STRUCTS_ENUMS
 
 #include "../server_metadata.h"
+#include "http_parser.h"
+#include "cache.h"
 #include <string>
+#include <vector>
 
 namespace web_server {
   template<server_type T>
   class basic_web_server;
 
+  constexpr size_t STREAM_FILE_MIN_SIZE = 1 << 20; //files at least this big are streamed with write_file_connection if possible, rather than read into the cache
+  constexpr size_t MAX_REQUEST_HEADER_SIZE = 16384; //if this much has been received without the end of the headers, the connection is closed
+  constexpr size_t COMPRESS_MIN_SIZE = 1024; //smaller files aren't worth compressing
+
+  //indexed by web_cache::content_encoding
+  constexpr const char *ENCODING_NAMES[web_cache::NUM_ENCODINGS] = { "identity", "br", "zstd", "gzip" }; //as used in Accept-Encoding and Content-Encoding
+  constexpr const char *ENCODING_EXTENSIONS[web_cache::NUM_ENCODINGS] = { "", ".br", ".zst", ".gz" }; //of precompressed copies, i.e index.html.br
+  constexpr web_cache::content_encoding PREFERRED_ENCODINGS[] = { web_cache::BROTLI, web_cache::ZSTD, web_cache::GZIP }; //best first
+
+  struct web_server_settings { //optional settings, read from the config file
+    int keep_alive_timeout = 5; //seconds a keep-alive connection can be idle for before it's closed
+    int keep_alive_max_requests = 100; //requests served on one connection before it's closed, 1 turns keep-alive off
+  };
+
   using tls_server = tcp_tls_server::server<server_type::TLS>;
   using plain_server = tcp_tls_server::server<server_type::NON_TLS>;
   using tls_web_server = basic_web_server<server_type::TLS>;
@@ -21,15 +38,36 @@ namespace web_server {
     pong = 0xA
   };
 
-  enum class message_type {
-    websocket_broadcast,
-    broadcast_finished
+  struct byte_range { //the part of a file asked for in a Range header
+    bool requested = false; //if false then the whole file is sent, with a 200
+    bool satisfiable = true; //if false then a 416 is sent
+    size_t start{};
+    size_t length{};
+  };
+
+  struct file_request_headers { //the request headers which change what's sent for a file, each is empty if it wasn't in the request
+    string_span range{};
+    string_span if_none_match{};
+    string_span if_modified_since{};
+    string_span accept_encoding{};
   };
 
   struct tcp_client {
     std::string last_requested_read_filepath{}; //the last filepath it was asked to read
+    web_cache::file_info last_requested_read_info{}; //for caching it once it's read
+    size_t last_requested_read_length{}; //how much of it was asked for, if less is read the file changed meanwhile
+    std::vector<char> response_head{}; //the headers to send in front of the file once it's read
+    bool cache_last_read = true; //only whole files are cached, not parts of them
+    int pending_writes{}; //how many writes make up the response being sent, it's only finished once they're all done
+
+    std::vector<char> request_buffer{}; //data received but not dealt with yet, i.e part of a request, or pipelined requests
+    http_parser parser{}; //parses the request at the start of request_buffer, and remembers how far it got
+    bool keep_alive = false; //whether the connection is kept open after the current response
+    int requests_served{};
+    bool waiting_for_request = false; //idle, so it's closed if no request is received in time
+    uint64_t idle_since_tick{}; //the idle timer tick when it started waiting
     int ws_client_idx = -1;
-    bool using_file = false;
+    web_cache::cache_entry_ptr cached_file{}; //the cached file being sent, held until the response has been written
   };
 }
 
@@ -0,0 +1,77 @@
+#ifndef HTTP_PARSER
+#define HTTP_PARSER
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <strings.h>
+#include <array>
+
+namespace web_server {
+  constexpr int MAX_HTTP_HEADERS = 64; //a request with more headers than this is rejected
+
+  struct string_span { //points into a buffer owned by something else, so it's only valid while that buffer is unchanged
+    string_span(const char *data = nullptr, size_t length = 0) : data(data), length(length) {}
+    const char *data;
+    size_t length;
+
+    bool empty() const { return length == 0; }
+    bool equals(const char *str) const { return strlen(str) == length && std::memcmp(data, str, length) == 0; }
+    bool equals_case_insensitive(const char *str) const { return strlen(str) == length && strncasecmp(data, str, length) == 0; }
+    bool has_token(const char *token) const; //for comma separated lists (i.e "keep-alive, Upgrade"), case insensitive
+    //for going through a comma separated list, sets item to the next one from position (without any spaces around it), false once there are none left
+    bool next_list_item(size_t &position, string_span &item) const;
+  };
+
+  enum class http_parse_result { INCOMPLETE, COMPLETE, ERROR };
+
+  //a resumable HTTP request parser, it doesn't allocate or modify the buffer, it only records where things are in it
+  //call parse with everything received for this request so far (the buffer can move between calls, i.e a vector growing),
+  //it carries on from the last complete line it saw, and once it returns COMPLETE the spans point into the last buffer passed in
+  class http_parser {
+    struct field { //positions rather than pointers, so they're still right if the buffer moves
+      field(uint32_t offset = 0, uint32_t length = 0) : offset(offset), length(length) {}
+      uint32_t offset;
+      uint32_t length;
+    };
+
+    enum class parse_state { REQUEST_LINE, HEADERS, COMPLETE, ERROR };
+
+    parse_state state = parse_state::REQUEST_LINE;
+    size_t line_start{}; //where the line currently being parsed starts
+    size_t request_end{}; //how many bytes the request took up, once it's complete
+    const char *base = nullptr; //the buffer passed in last time
+
+    field method_field{};
+    field target_field{};
+    field version_field{};
+
+    std::array<field, MAX_HTTP_HEADERS> header_names{};
+    std::array<field, MAX_HTTP_HEADERS> header_values{};
+    int num_headers{};
+
+    string_span get(const field &f) const { return { base + f.offset, f.length }; }
+
+    bool parse_request_line(const char *line, const char *line_end);
+    bool parse_header_line(const char *line, const char *line_end, const char *colon);
+  public:
+    http_parse_result parse(const char *data, size_t length);
+    void reset(){ *this = http_parser(); } //ready for the next request
+
+    size_t request_length() const { return request_end; } //the request line, headers, and blank line
+
+    string_span method() const { return get(method_field); }
+    string_span target() const { return get(target_field); }
+    string_span version() const { return get(version_field); }
+
+    int header_count() const { return num_headers; }
+    string_span header_name(int idx) const { return get(header_names[idx]); }
+    string_span header_value(int idx) const { return get(header_values[idx]); }
+    string_span header(const char *name) const; //value of the first header with this name (case insensitive), empty if there isn't one
+  };
+
+  //finds the first a or b in [begin, end), or returns end, uses SSE2/SSE4.2/AVX2 depending on what it's compiled for
+  const char *find_first_of(const char *begin, const char *end, char a, char b);
+}
+
+#endif
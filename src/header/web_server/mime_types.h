@@ -0,0 +1,24 @@
+#ifndef MIME_TYPES
+#define MIME_TYPES
+
+#include <cstddef>
+#include <cstdint>
+
+namespace web_server {
+  //FNV-1a of the lowercased string, it's constexpr so that the extensions' hashes are worked out at compile time
+  constexpr uint32_t mime_hash(const char *str, size_t length, uint32_t hash = 2166136261u){
+    return length == 0 ? hash : mime_hash(str + 1, length - 1, (hash ^ (uint8_t)(*str >= 'A' && *str <= 'Z' ? *str + ('a' - 'A') : *str)) * 16777619u);
+  }
+
+  template<size_t N>
+  constexpr uint32_t mime_hash(const char (&str)[N]){ //for string literals
+    return mime_hash(str, N - 1);
+  }
+
+  //the whole Content-Type header line for the file's extension (i.e "Content-Type: text/html\r\n"), application/octet-stream if it's unknown
+  //the extensions are switch cases on their hashes, so the compiler rejects the table if any two of them collide
+  const char *get_content_type(const char *filepath, size_t length);
+  bool is_compressible(const char *content_type); //for a header line from get_content_type, true for text, which compresses well
+}
+
+#endif
@@ -4,17 +4,19 @@
 #include "../server.h"
 #include "../utility.h"
 #include "../callbacks.h"
-#include "../data_store.h"
 
 #include "../utility.h"
 
 #include "common_structs_enums.h"
 #include "cache.h"
-
-#include "../../vendor/readerwriterqueue/atomicops.h"
-#include "../../vendor/readerwriterqueue/readerwriterqueue.h"
+#include "mime_types.h"
+#include "broadcast_channel.h"
+#include "certificate_watcher.h"
 
 #include <thread>
+#include <algorithm>
+#include <strings.h>
+#include <ctime>
 
 #include <openssl/sha.h>
 #include <openssl/evp.h>
@@ -42,22 +44,6 @@ namespace web_server{
     int client_idx = -1; //for the TCP/TLS layer
   };
 
-  struct message_post_data {
-    message_post_data(message_type msg_type = message_type::websocket_broadcast, const char *buff_ptr = nullptr, size_t length = 0, int item_idx = 0, uint64_t additional_info = 0) : msg_type(msg_type), buff_ptr(buff_ptr), length(length), item_idx(item_idx), additional_info(additional_info) {}
-    message_type msg_type;
-    const char *buff_ptr;
-    uint64_t length;
-    int item_idx;
-    uint64_t additional_info;
-  };
-
-  struct broadcast_data_items {
-    const char* buff_ptr{};
-    size_t data_len{};
-    size_t uses{};
-    broadcast_data_items(const char* buff_ptr = nullptr, size_t data_len = -1, uint64_t uses = -1) : buff_ptr(buff_ptr), data_len(data_len), uses(uses) {}
-  };
-
   template<server_type T>
   class basic_web_server{
     //
@@ -65,7 +51,30 @@ namespace web_server{
     //
     tcp_tls_server::server<T> *tcp_server = nullptr;
 
-    std::string get_content_type(std::string filepath);
+    byte_range parse_range(string_span range_header, size_t file_size); //parses the value of a Range header (i.e bytes=0-499)
+
+    //
+    ////building responses
+    //
+    std::string keep_alive_header{}; //the Connection and Keep-Alive headers, made from the settings in set_tcp_server
+    file_info get_file_info(int file_fd, const char *content_type, content_encoding encoding);
+    //the headers for sending the range of a file, the connection headers depend on keep_alive, these are static (with the server's
+    //keep_alive_header passed in) since cache entries are also made on the cache's compression thread, which can outlive this server
+    static std::string make_response_head(int response_code, const byte_range &range, const file_info &info, bool keep_alive, const std::string &keep_alive_header);
+    void send_range_not_satisfiable(int client_idx, size_t file_size); //a 416, for when none of the range asked for is in the file
+    static std::string make_not_modified_head(const file_info &info, bool keep_alive, const std::string &keep_alive_header); //a 304
+    //whether the client's copy is still current, going by If-None-Match, or If-Modified-Since if there's no If-None-Match
+    bool is_not_modified(const file_request_headers &request_headers, const file_info &info);
+    int parse_accept_encoding(string_span accept_encoding); //the encoding_bits of the encodings the client accepts
+    //makes the cache entry for a file which has been read, with the headers for the usual responses already made
+    static cache_entry_ptr make_cache_entry(file_body &&body, file_info &&info, const std::string &keep_alive_header);
+    void find_precompressed(const std::string &filepath, file_info &info); //sets which compressed copies are next to the file
+    void cache_file(const std::string &filepath, const cache_entry_ptr &entry); //caches the entry if it fits, and has it compressed if it's worth it
+
+    void send_cached_file(int client_idx, const cache_entry_ptr &cached_file, const file_request_headers &request_headers, int response_code);
+    //opens and reads the file, content_type and encoding are for the headers, since a precompressed copy is sent as the original, returns false if it can't be opened
+    bool send_uncached_file(int client_idx, const std::string &filepath, const char *content_type, content_encoding encoding,
+      const file_request_headers &request_headers, int response_code);
 
     //
     ////websocket stuff////
@@ -93,14 +102,12 @@ namespace web_server{
     ////communication between threads////
     //
 
-    //lock free queues used to transport data between threads
-    moodycamel::ReaderWriterQueue<message_post_data> to_server_queue{};
-    moodycamel::ReaderWriterQueue<message_post_data> to_program_queue{};
+    void websocket_broadcast(const broadcast_frame &frame); //writes the frame to every active websocket client
 
   public:
     static std::vector<char> make_ws_frame(const std::string &packet_msg, websocket_non_control_opcodes opcode);
     
-    basic_web_server(basic_web_server &&server) = default;
+    basic_web_server(const basic_web_server&) = delete; //it owns idle_timerfd, and its thread holds a reference to it, so it's never moved or copied
     basic_web_server() {};
 
     void set_tcp_server(tcp_tls_server::server<T> *tcp_server); //required to be called to ensure pointer to TCP server is present
@@ -112,47 +119,39 @@ namespace web_server{
 
     std::vector<tcp_client> tcp_clients{}; //storing additional data related to the client_idxs passed to this layer
 
-    //thread stuff
-    int central_communication_eventfd = eventfd(0, 0);
-    
-    std::vector<broadcast_data_items> broadcast_data{}; // data from any broadcasts sent from the program thread
+    web_server_settings settings{}; //set before set_tcp_server is called
 
-    void post_message_to_server_thread(message_type msg_type, const char *buff_ptr, size_t length, int item_idx, uint64_t additional_info = -1){ //called from the program thread, to notify the server thread
-      if(!tcp_server) return; // need this set before posting any messages
-      to_server_queue.emplace(msg_type, buff_ptr, length, item_idx, additional_info);
-      tcp_server->notify_event();
-    }
+    //closing idle keep-alive connections
+    int idle_timerfd = timerfd_create(CLOCK_MONOTONIC, 0); //ticks every second
+    uint64_t idle_ticks{}; //how many times the idle timer has gone off
+    void close_idle_connections(); //called on each tick of the idle timer
 
-    void post_message_to_program(message_type msg_type, const char *buff_ptr, size_t length, int item_idx, uint64_t additional_info = -1){
-      if(!tcp_server) return; // need this stuff set before posting any messages
-      to_program_queue.emplace(msg_type, buff_ptr, length, item_idx, additional_info);
-      eventfd_write(central_communication_eventfd, 1); //notify the program thread using our eventfd
-    }
-    
-    message_post_data get_from_to_program_queue(){ // so called from main program thread
-      message_post_data data{};
-      to_program_queue.try_dequeue(data);
-      return data;
-    }
+    //thread stuff
+    broadcast_channel *broadcasts = nullptr; //where broadcasts from the central thread come from, set before set_tcp_server is called
+    int broadcast_consumer = -1; //this thread's idx in broadcasts, set in set_tcp_server
 
-    message_post_data get_from_to_server_queue(){ // so called from associated server thread
-      message_post_data data{};
-      to_server_queue.try_dequeue(data);
-      return data;
-    }
+    void receive_broadcasts(); //writes every broadcast published since the last call, called when the thread is notified
+    void stop_receiving_broadcasts(); //called before the TCP server is destroyed, so the central thread stops notifying it
 
     //
     ////http public methods
     //
 
+    //requests are buffered and parsed incrementally, then dealt with one at a time, so pipelined requests are responded to in order
+    void http_process_read_cb(int client_idx, const char *buffer, int length);
+    void process_next_http_request(int client_idx); //deals with the next buffered request, or reads more if there isn't a full one
+    bool http_process_write_cb(int client_idx); //returns whether the connection was kept alive, call once a response is fully written
     //responding to get requests
-    bool get_process(std::string &path, bool accept_bytes, const std::string& sec_websocket_key, int client_idx);
-    //sending files
-    bool send_file_request(int client_idx, const std::string &filepath, bool accept_bytes, int response_code);
+    bool get_process(std::string &path, const file_request_headers &request_headers, const std::string& sec_websocket_key, int client_idx);
+    //sending files, if the request had a Range header, only the part of the file it asks for is sent,
+    //and if it had If-None-Match or If-Modified-Since, and the client's copy is current, a 304 is sent instead,
+    //otherwise a compressed copy is sent if the client accepts it, either one next to the file (i.e index.html.br), or one gzipped by the cache
+    bool send_file_request(int client_idx, const std::string &filepath, const file_request_headers &request_headers, int response_code);
     //checking if it's a valid HTTP request
     bool is_valid_http_req(const char* buff, int length);
-    //the cache
-    cache<5> web_cache{}; //cache of 5 items
+    //the cache, shared by all of the server threads, and set before set_tcp_server is called
+    web_cache::cache *web_cache = nullptr;
+    void file_read_cb(int client_idx, std::vector<char> &&buff); //sends (and caches if it's the whole file) a file once it's been read
     
     //
     ////public websocket stuff
@@ -168,7 +167,9 @@ namespace web_server{
     std::unordered_set<int> active_websocket_connections_client_idxs{}; //this is only active up until we call a close request, has client_idx
 
     ~basic_web_server(){
-      close(web_cache.inotify_fd);
+      stop_receiving_broadcasts();
+      if(idle_timerfd != -1)
+        close(idle_timerfd);
     }
   };
 
@@ -176,7 +177,7 @@ namespace web_server{
   #include "../../web_server/websockets.tcc"
 }
 
-enum class central_web_server_event { TIMERFD, READ, WRITE, SERVER_THREAD_COMMUNICATION, KILL_SERVER };
+enum class central_web_server_event { TIMERFD, READ, WRITE, KILL_SERVER, INOTIFY };
 
 struct central_web_server_req {
   central_web_server_event event{};
@@ -189,6 +190,17 @@ struct central_web_server_req {
   int fd = -1;
 
   uint64_t custom_info = -1;
+
+  uint64_t pool_idx{}; // index in the request pool, stored as the SQE's user_data
+
+  void reset(){ // readies this for reuse by the pool, keeping the buffer's memory
+    auto old_buff = std::move(buff);
+    const auto idx = pool_idx;
+    *this = central_web_server_req();
+    old_buff.clear();
+    buff = std::move(old_buff);
+    pool_idx = idx;
+  }
 };
 
 class central_web_server {
@@ -199,9 +211,13 @@ private:
   friend struct server_data;
 
   static std::unordered_map<std::string, std::string> config_data_map;
+  static tcp_tls_server::server_settings get_server_settings(int thread_idx); // builds the optional TCP server settings from the config, for the thread_idx'th server thread
+  static std::vector<int> get_cpu_list(const std::string &key); // a comma separated list of CPUs in the config, empty if it isn't there
+  static void pin_server_thread(int thread_idx); // pins the calling thread to its CPU from SERVER_THREAD_CPUS, if it's set
+  static web_server::web_server_settings get_web_server_settings(); // builds the optional web server settings from the config
 
   template<server_type T>
-  static void thread_server_runner(web_server::basic_web_server<T> &basic_web_server);
+  static void thread_server_runner(web_server::basic_web_server<T> &basic_web_server, int thread_idx);
 
   central_web_server() {};
 
@@ -214,11 +230,23 @@ private:
   int kill_server_efd = eventfd(0, 0);
   
   io_uring ring;
+  request_pool_namespace::request_pool<central_web_server_req> requests{}; // every request is taken from here and given back once its CQE is done with
+
+  io_uring_sqe *get_sqe(); // gets an SQE, submitting early only if the submission queue is full (submission normally happens once per loop in run())
+
+  web_server::broadcast_channel broadcasts{}; // frames sent to every server thread, which free them once they've been written
+
+  web_cache::cache file_cache{}; // the file cache used by every server thread, the inotify events for it are read here
+
+  web_server::certificate_watcher certificate_watcher{}; // reloads the TLS certificates for every server thread when they change, or on SIGHUP
 
-  data_store_namespace::data_store store{}; // the data store
+  static constexpr int SESSION_STATS_INTERVAL = 60; // how many timer ticks (seconds) between printing the TLS handshake counts
+  uint64_t last_printed_handshakes{}; // so they're only printed if there have been more since
+  void print_session_stats(); // how many TLS handshakes resumed a session, so you can see if session tickets are working
 
   void add_event_read_req(int eventfd, central_web_server_event event, uint64_t custom_info = 0); // adds io_uring read request for the eventfd
   void add_timer_read_req(int timerfd); // adds io_uring read request for the timerfd
+  void add_inotify_read_req(); // adds io_uring read request for the file cache's inotify fd
   void add_read_req(int fd, size_t size); // adds normal read request on io_uring
   void add_write_req(int fd, const char *buff_ptr, size_t size); // adds normal write request on io_uring
 
@@ -244,10 +272,9 @@ template<server_type T>
 struct server_data {
   std::thread thread{};
   web_server::basic_web_server<T> server{};
-  server_data(){
-    thread = std::thread(central_web_server::thread_server_runner<T>, std::ref(server));
+  server_data(int thread_idx){
+    thread = std::thread(central_web_server::thread_server_runner<T>, std::ref(server), thread_idx);
   }
-  server_data(server_data &&data) = default;
 };
 
 #endif
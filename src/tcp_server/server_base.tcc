@@ -16,95 +16,175 @@ void server_base<T>::start(){ //function to run the server
   if(!ran_server){
     ran_server = true;
 
-    io_uring_cqe *cqe;
+    io_uring_cqe *cqes[CQE_BATCH_SIZE];
 
     add_tcp_accept_req();
 
-    while(true){
-      char ret = io_uring_wait_cqe(&ring, &cqe);
-      if(ret < 0)
-        utility::fatal_error("io_uring_wait_cqe");
-      request *req = (request*)cqe->user_data;
-
-      if(req->event != event_type::ACCEPT &&
-        req->event != event_type::KILL &&
-        req->event != event_type::NOTIFICATION &&
-        req->event != event_type::CUSTOM_READ &&
-        req->event != event_type::TIMERFD &&
-        (cqe->res <= 0 || (req->client_idx > 0 && clients[req->client_idx].id != req->ID)))
-      {
-        if(req->event == event_type::ACCEPT_WRITE || req->event == event_type::WRITE)
-          req->buffer = nullptr; //done with the request buffer
-        if(cqe->res <= 0 && clients[req->client_idx].id == req->ID){ // only do these if the client hasn't been replaced
-          auto &client = clients[req->client_idx];
-          if(req->event == event_type::WRITE || req->event == event_type::ACCEPT_WRITE)
-            client.num_write_reqs--; // a write operation failed, decrement the number of active write operaitons for this client
-
-          if(client.num_write_reqs == 0){
-            while(client.send_data.size()){
-              auto &send_data = client.send_data.front();
+    bool killed = false;
+    while(!killed){
+      //every SQE prepared while handling the last batch is submitted here in one go, along with waiting for the next completions
+      int ret = 0;
+      if(settings.cqe_wait_nr > 1){
+        io_uring_cqe *cqe = nullptr;
+        ret = io_uring_submit_and_wait_timeout(&ring, &cqe, settings.cqe_wait_nr, &cqe_wait_timeout, nullptr);
+        if(ret == -ETIME) ret = 0; //timing out with fewer than cqe_wait_nr completions is expected when it's quiet
+      }else{
+        ret = io_uring_submit_and_wait(&ring, 1);
+      }
+      if(ret < 0 && ret != -EINTR)
+        utility::fatal_error("io_uring_submit_and_wait");
+
+      //reap every completion which is ready, and only advance the completion queue once they've all been dealt with
+      const unsigned cqe_count = io_uring_peek_batch_cqe(&ring, cqes, CQE_BATCH_SIZE);
+      for(unsigned i = 0; i < cqe_count; i++){
+        io_uring_cqe *cqe = cqes[i];
+        request *req = requests.get(cqe->user_data);
+
+        if(cqe->flags & IORING_CQE_F_NOTIF){ //the kernel is done with the buffers of one of a zero copy request's sends
+          if(--req->zc_notifications == 0 && req->zc_finished)
+            requests.release(req);
+          continue;
+        }
+        if(req->zero_copy && (cqe->flags & IORING_CQE_F_MORE)) //the send's notification comes later
+          req->zc_notifications++;
+
+        //multishot receives put their data in a buffer from the buffer ring, it goes back to the ring after this CQE unless it's held
+        current_read_buffer_id = cqe->flags & IORING_CQE_F_BUFFER ? cqe->flags >> IORING_CQE_BUFFER_SHIFT : -1;
+        current_read_buffer_held = false;
+        if(current_read_buffer_id != -1)
+          recv_buffers_in_ring--;
+
+        const bool client_replaced = req->client_idx >= 0 && clients[req->client_idx].id != req->ID;
+        if(req->multishot && !(cqe->flags & IORING_CQE_F_MORE) && !client_replaced && req->client_idx != -1)
+          clients[req->client_idx].read_req_active = false; //the kernel has stopped the multishot read
+
+        if(req->event == event_type::READ && cqe->res == -ENOBUFS){
+          //the buffer ring ran dry, so this read is rearmed once some buffers have been given back
+          if(!client_replaced)
+            starved_reads.push_back(req->client_idx);
+        }else if(req->event != event_type::ACCEPT &&
+          req->event != event_type::KILL &&
+          req->event != event_type::NOTIFICATION &&
+          req->event != event_type::CUSTOM_READ &&
+          req->event != event_type::TIMERFD &&
+          req->event != event_type::CLOSE &&
+          (cqe->res <= 0 || client_replaced))
+        {
+          if(req->event == event_type::ACCEPT_WRITE || req->event == event_type::WRITE)
+            req->buffer = nullptr; //done with the request buffer
+          if(cqe->res <= 0 && clients[req->client_idx].id == req->ID){ // only do these if the client hasn't been replaced
+            auto &client = clients[req->client_idx];
+            if(req->event == event_type::WRITE || req->event == event_type::ACCEPT_WRITE || req->event == event_type::SPLICE_IN || req->event == event_type::SPLICE_OUT)
+              client.num_write_reqs--; // a write operation failed, decrement the number of active write operaitons for this client
+
+            if(client.num_write_reqs == 0){
+              //a failed zero copy send's earlier sends might still be read by the kernel, so the request keeps their items until the notifications arrive
+              size_t zc_held = req->zero_copy && req->zc_notifications ? req->items : 0;
+              while(client.send_data.size()){
+                auto &send_data = client.send_data.front();
               
-              int broadcast_additional_info = send_data.broadcast ? send_data.custom_info : -1;
-              if(close_cb != nullptr) close_cb(req->client_idx, broadcast_additional_info, static_cast<server<T>*>(this), custom_obj); // might have had multiple broadcasts
-
-              client.send_data.pop();
+                int broadcast_additional_info = send_data.broadcast ? send_data.custom_info : -1;
+                if(close_cb != nullptr) close_cb(req->client_idx, broadcast_additional_info, static_cast<server<T>*>(this), custom_obj); // might have had multiple broadcasts
+
+                if(zc_held){
+                  req->zc_items.push_back(std::move(send_data));
+                  zc_held--;
+                }
+                client.send_data.pop_front();
+              }
+
+              if(client.send_data.size() == 0) // there was no send_data and no broadcast, so we close it once here
+                if(close_cb != nullptr) close_cb(req->client_idx, -1, static_cast<server<T>*>(this), custom_obj);
+            
+              static_cast<server<T>*>(this)->close_connection(req->client_idx); //making sure to remove any data relating to it as well
             }
+          }
+        }else if(req->event == event_type::KILL) {
+          killed = true; //the ring is torn down once the rest of this batch has been dealt with
+        }else if(req->event == event_type::NOTIFICATION){
+          event_read(notification_efd, event_type::NOTIFICATION);
+          if(event_cb != nullptr) event_cb(static_cast<server<T>*>(this), custom_obj);
+        }else if(req->event == event_type::CUSTOM_READ){
+          const bool read_failed = cqe->res <= 0; //i.e the file's shrunk since it was stat'ed, so asking again would never fill the buffer
+          if(read_failed)
+            req->read_data.resize(req->read_amount); //the callback is given only what was read, so it can tell from the size
+          if(read_failed || req->read_data.size() == cqe->res + req->read_amount){
+            if(custom_read_cb != nullptr) custom_read_cb(req->client_idx, (int)req->custom_info, std::move(req->read_data), static_cast<server<T>*>(this), custom_obj);
+          }else{
+            custom_read_req_continued(req, cqe->res);
+            req = nullptr; //don't want it to be given back to the pool yet
+          }
+        }else if(req->event == event_type::CLOSE){
+          //the socket's shutdown or close is done, there's nothing else to do (if it failed, the socket was already gone)
+        }else if(req->event == event_type::TIMERFD && fixed_files){
+          //fixed file sockets can't be peeked at outside of the ring, but closed connections are still found by their reads failing
+          add_timerfd_read_req();
+        }else if(req->event == event_type::TIMERFD){
+          auto active_connections_copy = active_connections; // since we possibly remove elements during the loop, we need a copy
+          for(auto client_idx : active_connections_copy){
+            uint64_t buff{};
+            if(recv(clients[client_idx].sockfd, &buff, sizeof(uint64_t), MSG_PEEK | MSG_DONTWAIT) == 0){
+              auto &client = clients[client_idx];
+
+              while(client.send_data.size() > 0){ // might have had multiple broadcasts, so remove all the elements
+                auto &send_data = client.send_data.front();
+              
+                int broadcast_additional_info = send_data.broadcast ? send_data.custom_info : -1;
+                if(close_cb != nullptr) close_cb(client_idx, broadcast_additional_info, static_cast<server<T>*>(this), custom_obj);
+
+                client.send_data.pop_front();
+              }
 
-            if(client.send_data.size() == 0) // there was no send_data and no broadcast, so we close it once here
-              if(close_cb != nullptr) close_cb(req->client_idx, -1, static_cast<server<T>*>(this), custom_obj);
+              if(client.send_data.size() == 0) // there was no send_data and no broadcast, so we close it once here
+                if(close_cb != nullptr) close_cb(client_idx, -1, static_cast<server<T>*>(this), custom_obj);
             
-            static_cast<server<T>*>(this)->close_connection(req->client_idx); //making sure to remove any data relating to it as well
+              static_cast<server<T>*>(this)->close_connection(client_idx); //making sure to remove any data relating to it as well
+            }
           }
-        }
-      }else if(req->event == event_type::KILL) {
-        io_uring_queue_exit(&ring);
-        close(listener_fd);
-        close(kill_efd);
-        close(notification_efd);
         
-        is_active = false; // received an exit signal, main server program will now exit, so it's now inactive
-        break;
-      }else if(req->event == event_type::NOTIFICATION){
-        event_read(notification_efd, event_type::NOTIFICATION);
-        if(event_cb != nullptr) event_cb(static_cast<server<T>*>(this), custom_obj);
-      }else if(req->event == event_type::CUSTOM_READ){
-        if(req->read_data.size() == cqe->res + req->read_amount){
-          if(custom_read_cb != nullptr) custom_read_cb(req->client_idx, (int)req->custom_info, std::move(req->read_data), static_cast<server<T>*>(this), custom_obj);
+          add_timerfd_read_req();
+        }else if(req->event == event_type::ACCEPT && cqe->res < 0){
+          //the accept failed (i.e too many open files), so there's no connection to set up, it's rearmed below
         }else{
-          custom_read_req_continued(req, cqe->res);
-          req = nullptr; //don't want it to be deleted yet
+          static_cast<server<T>*>(this)->req_event_handler(req, cqe->res);
         }
-      }else if(req->event == event_type::TIMERFD){
-        auto active_connections_copy = active_connections; // since we possibly remove elements during the loop, we need a copy
-        for(auto client_idx : active_connections_copy){
-          uint64_t buff{};
-          if(recv(clients[client_idx].sockfd, &buff, sizeof(uint64_t), MSG_PEEK | MSG_DONTWAIT) == 0){
-            auto &client = clients[client_idx];
-
-            while(client.send_data.size() > 0){ // might have had multiple broadcasts, so remove all the elements
-              auto &send_data = client.send_data.front();
-              
-              int broadcast_additional_info = send_data.broadcast ? send_data.custom_info : -1;
-              if(close_cb != nullptr) close_cb(client_idx, broadcast_additional_info, static_cast<server<T>*>(this), custom_obj);
 
-              client.send_data.pop();
-            }
+        if(req != nullptr && req->event == event_type::ACCEPT && !(cqe->flags & IORING_CQE_F_MORE))
+          add_tcp_accept_req(); //single shot accepts always need rearming, multishot ones only once the kernel has stopped them
 
-            if(client.send_data.size() == 0) // there was no send_data and no broadcast, so we close it once here
-              if(close_cb != nullptr) close_cb(client_idx, -1, static_cast<server<T>*>(this), custom_obj);
-            
-            static_cast<server<T>*>(this)->close_connection(client_idx); //making sure to remove any data relating to it as well
-          }
+        if(current_read_buffer_id != -1 && !current_read_buffer_held)
+          recycle_read_buffer(current_read_buffer_id);
+
+        if(req != nullptr && req->zc_notifications){ //a finished zero copy write, which is released once the kernel is done with its buffers
+          req->zc_finished = true;
+          continue;
         }
-        
-        add_timerfd_read_req();
-      }else{
-        static_cast<server<T>*>(this)->req_event_handler(req, cqe->res);
+
+        if(cqe->flags & IORING_CQE_F_MORE)
+          continue; //a multishot request which is still armed, so it's kept for the next completion
+
+        if(req != nullptr)
+          requests.release(req); //back to the pool, rather than being freed
       }
 
-      delete req;
-      io_uring_cqe_seen(&ring, cqe); //mark this CQE as seen
+      if(starved_reads.size() && recv_buffers_in_ring > 0){ //some buffers are back in the ring, so reads which ran out can be rearmed
+        for(auto client_idx : starved_reads)
+          if(active_connections.count(client_idx))
+            add_read_req(client_idx, event_type::READ);
+        starved_reads.clear();
+      }
+
+      static_cast<server<T>*>(this)->flush_pending_writes(); //anything written during the batch goes out in as few writes as possible
+
+      io_uring_cq_advance(&ring, cqe_count); //mark the whole batch as seen
     }
+
+    io_uring_queue_exit(&ring);
+    close(listener_fd);
+    close(kill_efd);
+    close(notification_efd);
+    
+    is_active = false; // received an exit signal, main server program will now exit, so it's now inactive
   }
 }
 
@@ -122,32 +202,103 @@ void server_base<T>::kill_server(){
 
 template<server_type T>
 void server_base<T>::event_read(int event_fd, event_type event){
-  io_uring_sqe *sqe = io_uring_get_sqe(&ring); //get a valid SQE (correct index and all)
-  request *req = new request(); //enough space for the request struct
+  io_uring_sqe *sqe = get_sqe(); //get a valid SQE (correct index and all)
+  request *req = requests.acquire();
   req->read_data.resize(sizeof(uint64_t));
   req->event = event;
   
   io_uring_prep_read(sqe, event_fd, &(req->read_data[0]), sizeof(uint64_t), 0); //don't read at an offset
-  io_uring_sqe_set_data(sqe, req);
-  io_uring_submit(&ring); //submits the event
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
 }
 
 template<server_type T>
-server_base<T>::server_base(int listen_port){
+io_uring_sqe *server_base<T>::get_sqe(){
+  io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+  if(sqe == nullptr){ //the submission queue is full, so flush what has been queued so far and try again
+    io_uring_submit(&ring);
+    sqe = io_uring_get_sqe(&ring);
+    //with sqpoll, submitting only tells the polling thread about them, so slots are only free once it's taken some
+    while(sqe == nullptr && (ring.flags & IORING_SETUP_SQPOLL)){
+      io_uring_sqring_wait(&ring);
+      sqe = io_uring_get_sqe(&ring);
+    }
+  }
+  return sqe;
+}
+
+template<server_type T>
+server_base<T>::server_base(int listen_port, const server_settings &settings) : settings(settings) {
   std::unique_lock<std::mutex> init_lock(init_mutex);
 
-  if(shared_ring_fd == -1){
-    std::memset(&ring, 0, sizeof(io_uring));
-    io_uring_queue_init(QUEUE_DEPTH, &ring, 0); //no flags, setup the queue
-    shared_ring_fd = ring.ring_fd;
-  }else{ //all subsequent threads therefore share the same backend
-    std::memset(&ring, 0, sizeof(io_uring));
-    io_uring_params params{};
+  if(settings.cqe_wait_nr > 1){ //a batch wait always has a timeout, otherwise a lone request could wait forever for others to arrive
+    const auto timeout_us = settings.cqe_wait_timeout_us ? settings.cqe_wait_timeout_us : DEFAULT_CQE_WAIT_TIMEOUT_US;
+    cqe_wait_timeout.tv_sec = timeout_us / 1000000;
+    cqe_wait_timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+  }
+
+  io_uring_params params{};
+  //all threads after the first share the same async backend, except with sqpoll, where attaching would also share the first ring's
+  //polling thread, rather than each ring having its own (which can be pinned to its own CPU)
+  if(shared_ring_fd != -1 && !settings.sqpoll){
     params.wq_fd = shared_ring_fd;
     params.flags = IORING_SETUP_ATTACH_WQ;
-    io_uring_queue_init_params(QUEUE_DEPTH, &ring, &params);
   }
+  const auto base_flags = params.flags;
+
+  if(settings.sqpoll){
+    params.flags |= IORING_SETUP_SQPOLL;
+    params.sq_thread_idle = settings.sq_thread_idle_ms;
+    if(settings.sq_thread_cpu != -1){
+      params.flags |= IORING_SETUP_SQ_AFF;
+      params.sq_thread_cpu = settings.sq_thread_cpu;
+    }
+  }
+  if(settings.single_issuer || settings.taskrun == task_run::DEFER) //the ring is only ever submitted to from the thread running start(), which is the one constructing it
+    params.flags |= IORING_SETUP_SINGLE_ISSUER;
+  if(settings.taskrun == task_run::COOP)
+    params.flags |= IORING_SETUP_COOP_TASKRUN;
+  else if(settings.taskrun == task_run::DEFER)
+    params.flags |= IORING_SETUP_DEFER_TASKRUN; //fine for the event loop, since it always waits for completions before reaping them
+
+  std::memset(&ring, 0, sizeof(io_uring));
+  int ret = io_uring_queue_init_params(QUEUE_DEPTH, &ring, &params);
+  if(ret < 0 && params.flags != base_flags){ //an older kernel, or sqpoll without the privileges for it, so it falls back to a normal ring
+    std::cerr << "Couldn't set up the io_uring with the requested flags (" << strerror(-ret) << "), so they won't be used" << std::endl;
+    const auto wq_fd = params.wq_fd;
+    params = io_uring_params();
+    params.flags = base_flags;
+    params.wq_fd = wq_fd;
+    std::memset(&ring, 0, sizeof(io_uring));
+    ret = io_uring_queue_init_params(QUEUE_DEPTH, &ring, &params);
+  }
+  if(ret < 0){
+    errno = -ret;
+    utility::fatal_error("io_uring_queue_init_params");
+  }
+  if(shared_ring_fd == -1)
+    shared_ring_fd = ring.ring_fd;
   
+  if(settings.multishot_recv && T == server_type::NON_TLS)
+    setup_read_buffer_ring();
+
+  if(settings.fixed_files){ //the table starts empty, and accepts put sockets into any free slot
+    const int ret = io_uring_register_files_sparse(&ring, settings.fixed_files);
+    if(ret == 0)
+      fixed_files = settings.fixed_files;
+    else
+      std::cerr << "Couldn't register " << settings.fixed_files << " fixed files (" << strerror(-ret) << "), so client sockets will be normal fds" << std::endl;
+  }
+
+  if(settings.zero_copy_threshold && T == server_type::NON_TLS){ //TLS encrypts into its own buffers, so it has nothing to gain
+    io_uring_probe *probe = io_uring_get_probe_ring(&ring);
+    if(probe && io_uring_opcode_supported(probe, IORING_OP_SEND_ZC) && io_uring_opcode_supported(probe, IORING_OP_SENDMSG_ZC))
+      zero_copy_threshold = settings.zero_copy_threshold;
+    else
+      std::cerr << "Zero copy sends aren't supported by this kernel, so they won't be used" << std::endl;
+    if(probe)
+      io_uring_free_probe(probe);
+  }
+
   event_read(kill_efd, event_type::KILL); //sets a read request for the signal eventfd
   event_read(notification_efd, event_type::NOTIFICATION); //sets a read request for the normal eventfd
   
@@ -168,7 +319,17 @@ template<server_type T>
 int server_base<T>::setup_client(int client_socket){ //returns index into clients array
   auto index = 0;
 
-  if(freed_indexes.size()){ //if there's a free index, give that
+  if(fixed_files){ //the socket is a slot in the file table, which no other client can have, so it's used as the index too
+    index = client_socket;
+    if(index >= (int)clients.size())
+      clients.resize(index + 1);
+    freed_indexes.erase(index);
+
+    auto &slot_client = clients[index];
+    const auto new_id = (slot_client.id + 1) % 100; //ID loops every 100
+    slot_client = client<T>();
+    slot_client.id = new_id;
+  }else if(freed_indexes.size()){ //if there's a free index, give that
     index = *freed_indexes.begin(); //get first element in set
     freed_indexes.erase(index); //erase first element in set
 
@@ -229,7 +390,7 @@ int server_base<T>::setup_listener(int port) {
   if(traverser == NULL) //means we didn't break, so never got a socket made successfully
     utility::fatal_error("no socket made");
 
-  if(listen(listener_fd, BACKLOG) == -1)
+  if(listen(listener_fd, settings.backlog) == -1)
     utility::fatal_error("listen");
 
   return listener_fd;
@@ -237,32 +398,92 @@ int server_base<T>::setup_listener(int port) {
 
 template<server_type T>
 int server_base<T>::add_accept_req(int listener_fd, sockaddr_storage *client_address, socklen_t *client_address_length){
-  io_uring_sqe *sqe = io_uring_get_sqe(&ring); //get a valid SQE (correct index and all)
-  io_uring_prep_accept(sqe, listener_fd, (sockaddr*)client_address, client_address_length, 0); //no flags set, prepares an SQE
-
-  request *req = new request();
+  io_uring_sqe *sqe = get_sqe(); //get a valid SQE (correct index and all)
+  if(fixed_files && settings.multishot_accept) //the CQE's result is the slot the socket was put in, rather than an fd
+    io_uring_prep_multishot_accept_direct(sqe, listener_fd, (sockaddr*)client_address, client_address_length, 0);
+  else if(fixed_files)
+    io_uring_prep_accept_direct(sqe, listener_fd, (sockaddr*)client_address, client_address_length, 0, IORING_FILE_INDEX_ALLOC);
+  else if(settings.multishot_accept)
+    io_uring_prep_multishot_accept(sqe, listener_fd, (sockaddr*)client_address, client_address_length, 0); //produces a CQE for every connection until it's stopped
+  else
+    io_uring_prep_accept(sqe, listener_fd, (sockaddr*)client_address, client_address_length, 0); //no flags set, prepares an SQE
+
+  request *req = requests.acquire();
   req->event = event_type::ACCEPT;
 
-  io_uring_sqe_set_data(sqe, req); //sets the SQE data
-  io_uring_submit(&ring); //submits the event
+  io_uring_sqe_set_data64(sqe, req->pool_idx); //sets the SQE data, the request's index in the pool
 
   return 0; //maybe return is required for something else later
 }
 
+template<server_type T>
+void server_base<T>::setup_read_buffer_ring(){
+  int ret = 0;
+  recv_buf_ring = io_uring_setup_buf_ring(&ring, settings.recv_buffer_count, RECV_BUFFER_GROUP, 0, &ret);
+  if(recv_buf_ring == nullptr){
+    errno = -ret;
+    utility::fatal_error("io_uring_setup_buf_ring (RECV_BUFFERS must be a power of 2, and the kernel >= 5.19)");
+  }
+
+  recv_buffers.resize((size_t)settings.recv_buffer_count * READ_SIZE);
+  const auto mask = io_uring_buf_ring_mask(settings.recv_buffer_count);
+  for(unsigned bid = 0; bid < settings.recv_buffer_count; bid++)
+    io_uring_buf_ring_add(recv_buf_ring, &recv_buffers[(size_t)bid * READ_SIZE], READ_SIZE, bid, mask, bid);
+  io_uring_buf_ring_advance(recv_buf_ring, settings.recv_buffer_count); //hand all of the buffers over to the kernel
+  recv_buffers_in_ring = settings.recv_buffer_count;
+}
+
+template<server_type T>
+void server_base<T>::recycle_read_buffer(int buffer_id){
+  const auto mask = io_uring_buf_ring_mask(settings.recv_buffer_count);
+  io_uring_buf_ring_add(recv_buf_ring, &recv_buffers[(size_t)buffer_id * READ_SIZE], READ_SIZE, buffer_id, mask, 0);
+  io_uring_buf_ring_advance(recv_buf_ring, 1);
+  recv_buffers_in_ring++;
+}
+
+template<server_type T>
+char *server_base<T>::get_read_data(request *req){
+  if(current_read_buffer_id != -1)
+    return &recv_buffers[(size_t)current_read_buffer_id * READ_SIZE];
+  return &(req->read_data[0]);
+}
+
+template<server_type T>
+int server_base<T>::hold_read_buffer(){
+  if(current_read_buffer_id == -1)
+    return -1; //the data isn't in the buffer ring, so it's only valid for the duration of the callback
+  current_read_buffer_held = true;
+  return current_read_buffer_id;
+}
+
+template<server_type T>
+void server_base<T>::release_read_buffer(int buffer_id){
+  if(buffer_id != -1)
+    recycle_read_buffer(buffer_id);
+}
+
 template<server_type T>
 int server_base<T>::add_read_req(int client_idx, event_type event){
   if(!clients[client_idx].read_req_active){
-    io_uring_sqe *sqe = io_uring_get_sqe(&ring); //get a valid SQE (correct index and all)
-    request *req = new request(); //enough space for the request struct
+    io_uring_sqe *sqe = get_sqe(); //get a valid SQE (correct index and all)
+    request *req = requests.acquire();
     req->total_length = READ_SIZE;;
     req->event = event;
     req->client_idx = client_idx;
     req->ID = clients[client_idx].id;
-    req->read_data.resize(READ_SIZE);
 
-    io_uring_prep_read(sqe, clients[client_idx].sockfd, &(req->read_data[0]), READ_SIZE, 0); //don't read at an offset
-    io_uring_sqe_set_data(sqe, req);
-    io_uring_submit(&ring); //submits the event
+    if(recv_buf_ring != nullptr && event == event_type::READ){
+      //the kernel picks a buffer from the ring only once data arrives, and the request stays armed until it's stopped
+      req->multishot = true;
+      io_uring_prep_recv_multishot(sqe, clients[client_idx].sockfd, nullptr, 0, 0);
+      sqe->flags |= IOSQE_BUFFER_SELECT;
+      sqe->buf_group = RECV_BUFFER_GROUP;
+    }else{
+      req->read_data.resize(READ_SIZE);
+      io_uring_prep_read(sqe, clients[client_idx].sockfd, &(req->read_data[0]), READ_SIZE, 0); //don't read at an offset
+    }
+    use_client_socket(sqe);
+    io_uring_sqe_set_data64(sqe, req->pool_idx);
     
     clients[client_idx].read_req_active = true;
     
@@ -274,20 +495,19 @@ int server_base<T>::add_read_req(int client_idx, event_type event){
 
 template<server_type T>
 void server_base<T>::add_timerfd_read_req(){
-  io_uring_sqe *sqe = io_uring_get_sqe(&ring); //get a valid SQE (correct index and all)
-  request *req = new request(); //enough space for the request struct
+  io_uring_sqe *sqe = get_sqe(); //get a valid SQE (correct index and all)
+  request *req = requests.acquire();
   req->total_length = sizeof(uint64_t);
   req->event = event_type::TIMERFD;
   req->read_data.resize(sizeof(uint64_t));
 
   io_uring_prep_read(sqe, timerfd, &(req->read_data[0]), sizeof(uint64_t), 0); //don't read at an offset
-  io_uring_sqe_set_data(sqe, req);
-  io_uring_submit(&ring); //submits the event
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
 }
 
 template<server_type T>
 int server_base<T>::add_write_req(int client_idx, event_type event, const char *buffer, unsigned int length) {
-  request *req = new request();
+  request *req = requests.acquire();
   req->client_idx = client_idx;
   req->total_length = length;
   req->buffer = buffer;
@@ -296,30 +516,104 @@ int server_base<T>::add_write_req(int client_idx, event_type event, const char *
 
   clients[client_idx].num_write_reqs++; // another write request is now active
   
-  io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+  io_uring_sqe *sqe = get_sqe();
   io_uring_prep_write(sqe, clients[client_idx].sockfd, buffer, length, 0); //do not write at an offset
-  io_uring_sqe_set_data(sqe, req);
-  io_uring_submit(&ring); //submits the event
+  use_client_socket(sqe);
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
 
   return 0;
 }
 
 template<server_type T>
-void server_base<T>::custom_read_req(int fd, size_t to_read, int client_idx, std::vector<char> &&buff, size_t read_amount){
-  request *req = new request();
+void server_base<T>::add_splice_req(int client_idx, event_type event, size_t length){
+  auto &client = clients[client_idx];
+
+  if(client.pipe_fds[0] == -1){ //the pipe is made the first time it's needed, and kept for the lifetime of the connection
+    if(pipe2(client.pipe_fds, O_CLOEXEC) == -1)
+      utility::fatal_error("pipe2");
+    fcntl(client.pipe_fds[1], F_SETPIPE_SZ, SPLICE_CHUNK_SIZE);
+  }
+
+  request *req = requests.acquire();
+  req->client_idx = client_idx;
+  req->total_length = length;
+  req->event = event;
+  req->ID = client.id;
+
+  client.num_write_reqs++; // as far as closing the connection goes, a splice is a write
+  
+  io_uring_sqe *sqe = get_sqe();
+  if(event == event_type::SPLICE_IN){
+    const auto &file_data = client.send_data.front();
+    io_uring_prep_splice(sqe, file_data.file_fd, file_data.file_offset, client.pipe_fds[1], -1, length, 0);
+  }else{
+    io_uring_prep_splice(sqe, client.pipe_fds[0], -1, client.sockfd, -1, length, 0);
+    use_client_socket(sqe); //for a splice this only applies to where it's going, which is the socket
+  }
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
+}
+
+template<server_type T>
+void server_base<T>::close_client_socket(int client_idx){
+  auto &client = clients[client_idx];
+  if(!fixed_files){
+    if(client.read_req_active)
+      shutdown(client.sockfd, SHUT_RDWR); //a pending read holds a reference to the socket (i.e an idle keep-alive connection), so it must be stopped for it to really close
+    close(client.sockfd);
+    return;
+  }
+
+  //the socket only exists in the file table, so it's shut down and closed through the ring, the slot is free once the close is done
+  //both SQEs are taken up front, since the shutdown is only linked to the close if they're submitted together
+  const unsigned needed = client.read_req_active ? 2 : 1;
+  if(io_uring_sq_space_left(&ring) < needed){
+    io_uring_submit(&ring);
+    while(io_uring_sq_space_left(&ring) < needed && (ring.flags & IORING_SETUP_SQPOLL))
+      io_uring_sqring_wait(&ring); //with sqpoll, slots are only free once the polling thread has taken some
+  }
+
+  if(client.read_req_active){ //same as above, the pending read would keep it open
+    io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+    request *req = requests.acquire();
+    req->event = event_type::CLOSE;
+    io_uring_prep_shutdown(sqe, client.sockfd, SHUT_RDWR);
+    sqe->flags |= IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK; //the close waits for it, and still happens if it fails (i.e the peer already went)
+    io_uring_sqe_set_data64(sqe, req->pool_idx);
+  }
+
+  io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+  request *req = requests.acquire();
+  req->event = event_type::CLOSE;
+  io_uring_prep_close_direct(sqe, client.sockfd);
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
+}
+
+template<server_type T>
+void server_base<T>::close_client_pipe(int client_idx){
+  auto &client = clients[client_idx];
+  if(client.pipe_fds[0] != -1){
+    close(client.pipe_fds[0]);
+    close(client.pipe_fds[1]);
+    client.pipe_fds[0] = client.pipe_fds[1] = -1;
+  }
+}
+
+template<server_type T>
+void server_base<T>::custom_read_req(int fd, size_t to_read, int client_idx, std::vector<char> &&buff, size_t read_amount, size_t file_offset){
+  request *req = requests.acquire();
   req->client_idx = client_idx;
   req->total_length = to_read;
   req->read_amount = read_amount;
-  req->read_data = buff;
+  req->read_data = std::move(buff);
+  req->file_offset = file_offset;
   req->custom_info = fd;
   req->event = event_type::CUSTOM_READ;
 
   req->read_data.resize(to_read + read_amount); //needs this much at least
 
-  io_uring_sqe *sqe = io_uring_get_sqe(&ring);
-  io_uring_prep_read(sqe, fd, &(req->read_data[read_amount]), READ_SIZE, 0);
-  io_uring_sqe_set_data(sqe, req);
-  io_uring_submit(&ring); //submits the event
+  io_uring_sqe *sqe = get_sqe();
+  io_uring_prep_read(sqe, fd, &(req->read_data[read_amount]), to_read, file_offset); //only asks for what's wanted, so it never reads past the buffer
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
 }
 
 template<server_type T>
@@ -330,14 +624,184 @@ void server_base<T>::custom_read_req_continued(request *req, size_t last_read){
   //the buffer is big enough to hold header data, but the amount we want to read is the total_length
   //but the initial read_amount is the offset of the header data, so we find the initial offset like this
 
-  io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+  io_uring_sqe *sqe = get_sqe();
   //the fd is stored in the custom info bit
-  io_uring_prep_read(sqe, (int)req->custom_info, &(req->read_data[req->read_amount]), READ_SIZE, req->read_amount - initial_offset);
-  io_uring_sqe_set_data(sqe, req);
-  io_uring_submit(&ring); //submits the event
+  io_uring_prep_read(sqe, (int)req->custom_info, &(req->read_data[req->read_amount]), req->read_data.size() - req->read_amount, req->file_offset + req->read_amount - initial_offset);
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
 }
 
 template<server_type T>
 void server_base<T>::add_tcp_accept_req(){
   add_accept_req(listener_fd, &client_address, &client_address_length);
-}
\ No newline at end of file
+}
+
+template<server_type T>
+void server_base<T>::write_front_item(int client_idx) {
+  auto &data_ref = clients[client_idx].send_data.front();
+  if(data_ref.file_fd == -1){ //data in memory, so it's written along with anything else queued up after it
+    add_gathered_write_req(client_idx);
+  }else if(data_ref.buff.size() == 0){ //a file with no headers, so go straight to splicing it
+    add_splice_req(client_idx, event_type::SPLICE_IN, std::min(data_ref.file_remaining, (size_t)SPLICE_CHUNK_SIZE));
+  }else{ //the headers for a file, it's spliced once they're written
+    add_write_req(client_idx, event_type::WRITE, data_ref.buff.data(), data_ref.buff.size());
+  }
+}
+
+template<server_type T>
+void server_base<T>::complete_front_items(int client_idx, size_t count, request *req) {
+  auto &client = clients[client_idx];
+  const auto id = client.id;
+
+  completed_broadcast_info.clear();
+  for(size_t i = 0; i < count; i++){ //remove the processed items
+    auto &data_ref = client.send_data.front();
+    completed_broadcast_info.push_back(data_ref.broadcast ? data_ref.custom_info : -1); //if it's broadcast, then custom_info must be the item_idx
+    if(req && req->zero_copy) //the kernel might still be reading it, so the request keeps it until the notifications arrive
+      req->zc_items.push_back(std::move(data_ref));
+    client.send_data.pop_front();
+  }
+
+  if(client.send_data.size() > 0) //if there's still some data in the queue, write it now
+    write_front_item(client_idx);
+
+  if(write_cb == nullptr) return;
+  for(const auto broadcast_additional_info : completed_broadcast_info){
+    if(!active_connections.count(client_idx) || clients[client_idx].id != id) //closed by an earlier write callback, so the rest are for nothing
+      break;
+    write_cb(client_idx, broadcast_additional_info, static_cast<server<T>*>(this), custom_obj); //call the write callback
+  }
+}
+
+template<server_type T>
+void server_base<T>::add_gathered_write_req(int client_idx) {
+  auto &client = clients[client_idx];
+  request *req = requests.acquire();
+  req->client_idx = client_idx;
+  req->event = event_type::WRITE;
+  req->ID = client.id;
+
+  size_t iov_count = 0;
+  bool can_send_zero_copy = true;
+  for(auto &data_ref : client.send_data){
+    const size_t needed = data_ref.has_head() ? 2 : 1;
+    if(data_ref.file_fd != -1 || iov_count + needed > IOV_MAX) //files are spliced on their own
+      break;
+    iov_count += needed;
+    req->total_length += (data_ref.has_head() ? data_ref.get_head().length : 0) + data_ref.get_ptr_and_size().length;
+    req->items++;
+    can_send_zero_copy = can_send_zero_copy && data_ref.can_send_zero_copy();
+  }
+  //below the threshold, copying the data is cheaper than pinning its pages and waiting for the notifications
+  req->zero_copy = zero_copy_threshold && req->total_length >= zero_copy_threshold && can_send_zero_copy;
+
+  client.num_write_reqs++; // another write request is now active
+  prep_gathered_writev(req);
+}
+
+template<server_type T>
+void server_base<T>::prep_gathered_writev(request *req) {
+  auto &send_data = clients[req->client_idx].send_data;
+
+  size_t skip = req->written; //whatever has already been written is left out
+  auto add_iovec = [&](write_data::ptr_and_size segment){
+    if(skip >= segment.length){
+      skip -= segment.length;
+      return;
+    }
+    req->iovs.push_back({ (void*)(segment.buff + skip), segment.length - skip });
+    skip = 0;
+  };
+
+  req->iovs.clear();
+  for(size_t i = 0; i < req->items; i++){
+    auto &data_ref = send_data[i];
+    if(data_ref.has_head())
+      add_iovec(data_ref.get_head());
+    add_iovec(data_ref.get_ptr_and_size());
+  }
+
+  io_uring_sqe *sqe = get_sqe();
+  const int sockfd = clients[req->client_idx].sockfd;
+  if(!req->zero_copy){
+    io_uring_prep_writev(sqe, sockfd, req->iovs.data(), req->iovs.size(), 0); //do not write at an offset
+  }else if(req->iovs.size() == 1){
+    io_uring_prep_send_zc(sqe, sockfd, req->iovs[0].iov_base, req->iovs[0].iov_len, 0, 0);
+  }else{
+    req->msg = msghdr();
+    req->msg.msg_iov = req->iovs.data();
+    req->msg.msg_iovlen = req->iovs.size();
+    io_uring_prep_sendmsg_zc(sqe, sockfd, &req->msg, 0);
+  }
+  use_client_socket(sqe);
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
+}
+
+template<server_type T>
+int server_base<T>::add_write_req_continued(request *req, int written) { //for long plain HTTP write requests, this writes at the correct offset
+  auto &client = clients[req->client_idx];
+
+  req->written += written;
+  if(req->items){ //whatever is left of the gathered items is written with one writev again
+    prep_gathered_writev(req);
+    return 0;
+  }
+
+  io_uring_sqe *sqe = get_sqe();
+  io_uring_prep_write(sqe, client.sockfd, &req->buffer[req->written], req->total_length - req->written, 0); //do not write at an offset
+  use_client_socket(sqe);
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
+  return 0;
+}
+
+template<server_type T>
+void server_base<T>::plain_write_event(request *&req, int cqe_res){
+  switch(req->event){
+    case event_type::WRITE: {
+      auto &client = clients[req->client_idx];
+      if(cqe_res + req->written < req->total_length && cqe_res > 0){ //if the current request isn't finished, continue writing
+        int rc = add_write_req_continued(req, cqe_res);
+        req = nullptr; //we don't want to free the req yet
+        if(rc == 0) break;
+      }
+      client.num_write_reqs--; // decrement number of active write requests
+      if(active_connections.count(req->client_idx) && client.id == req->ID){
+        //the above will check specifically if the client is still valid, since in the case that
+        //a new client joins immediately after old one leaves, they might get the same clients
+        //array index, but the ID's would be different
+        auto &data_ref = client.send_data.front();
+        if(req->items == 0) //those were the headers for a file, so now the file itself is spliced
+          add_splice_req(req->client_idx, event_type::SPLICE_IN, std::min(data_ref.file_remaining, (size_t)SPLICE_CHUNK_SIZE));
+        else
+          complete_front_items(req->client_idx, req->items, req);
+      }else if(write_cb != nullptr){
+        write_cb(req->client_idx, -1, static_cast<server<T>*>(this), custom_obj); //call the write callback
+      }
+      break;
+    }
+    case event_type::SPLICE_IN: { //part of the file is now in the pipe, so move it to the socket
+      auto &client = clients[req->client_idx];
+      client.num_write_reqs--;
+      if(active_connections.count(req->client_idx)){
+        auto &data_ref = client.send_data.front();
+        data_ref.file_offset += cqe_res;
+        data_ref.file_remaining -= cqe_res;
+        add_splice_req(req->client_idx, event_type::SPLICE_OUT, cqe_res);
+      }
+      break;
+    }
+    case event_type::SPLICE_OUT: {
+      auto &client = clients[req->client_idx];
+      client.num_write_reqs--;
+      if(active_connections.count(req->client_idx)){
+        auto &data_ref = client.send_data.front();
+        if(cqe_res < req->total_length) //the socket didn't take everything, so send the rest of what's in the pipe
+          add_splice_req(req->client_idx, event_type::SPLICE_OUT, req->total_length - cqe_res);
+        else if(data_ref.file_remaining > 0) //the pipe is empty, so move the next chunk into it
+          add_splice_req(req->client_idx, event_type::SPLICE_IN, std::min(data_ref.file_remaining, (size_t)SPLICE_CHUNK_SIZE));
+        else
+          complete_front_items(req->client_idx, 1);
+      }
+      break;
+    }
+  }
+}
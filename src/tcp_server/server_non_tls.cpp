@@ -23,8 +23,9 @@ server<server_type::NON_TLS>::server(
   read_callback<server_type::NON_TLS> r_cb,
   write_callback<server_type::NON_TLS> w_cb,
   event_callback<server_type::NON_TLS> e_cb,
-  custom_read_callback<server_type::NON_TLS> cr_cb
-) : server_base<server_type::NON_TLS>(listen_port) { //call parent constructor with the port to listen on
+  custom_read_callback<server_type::NON_TLS> cr_cb,
+  const server_settings &settings
+) : server_base<server_type::NON_TLS>(listen_port, settings) { //call parent constructor with the port to listen on
   this->accept_cb = a_cb;
   this->close_cb = c_cb;
   this->read_cb = r_cb;
@@ -39,54 +40,61 @@ server<server_type::NON_TLS>::server(
 
 void server<server_type::NON_TLS>::write_connection(int client_idx, std::vector<char> &&buff) {
   auto &client = clients[client_idx];
-  client.send_data.emplace(std::move(buff));
-  if(client.send_data.size() == 1){ //only adds a write request in the case that the queue was empty before this
-    auto &data_ref = client.send_data.front();
-    auto &buff = data_ref.buff;
-    add_write_req(client_idx, event_type::WRITE, &buff[0], buff.size());
-  }
+  client.send_data.emplace_back(std::move(buff));
+  if(client.send_data.size() == 1) //only adds a write request in the case that the queue was empty before this
+    write_front_item(client_idx);
 }
 
-void server<server_type::NON_TLS>::write_connection(int client_idx, char* buff, size_t length) {
+void server<server_type::NON_TLS>::write_connection(int client_idx, const char *buff, size_t length, std::shared_ptr<const void> owner) {
   auto &client = clients[client_idx];
-  client.send_data.emplace(buff, length);
-  if(client.send_data.size() == 1){ //only adds a write request in the case that the queue was empty before this
-    auto &data_ref = client.send_data.front();
-    auto &buff = data_ref.ptr_buff;
-    add_write_req(client_idx, event_type::WRITE, buff, length);
-  }
+  client.send_data.emplace_back(buff, length);
+  client.send_data.back().owner = std::move(owner);
+  if(client.send_data.size() == 1) //only adds a write request in the case that the queue was empty before this
+    write_front_item(client_idx);
+}
+
+void server<server_type::NON_TLS>::write_connection(int client_idx, std::vector<char> &&head, const char *buff, size_t length, std::shared_ptr<const void> owner) {
+  auto &client = clients[client_idx];
+  client.send_data.emplace_back(std::move(head), buff, length);
+  client.send_data.back().owner = std::move(owner);
+  if(client.send_data.size() == 1) //only adds a write request in the case that the queue was empty before this
+    write_front_item(client_idx);
+}
+
+void server<server_type::NON_TLS>::write_connection(int client_idx, const char *head, size_t head_length, const char *buff, size_t length, std::shared_ptr<const void> owner) {
+  auto &client = clients[client_idx];
+  client.send_data.emplace_back(head, head_length, buff, length);
+  client.send_data.back().owner = std::move(owner);
+  if(client.send_data.size() == 1) //only adds a write request in the case that the queue was empty before this
+    write_front_item(client_idx);
+}
+
+bool server<server_type::NON_TLS>::write_file_connection(int client_idx, int file_fd, size_t offset, size_t length, std::vector<char> &&headers) {
+  auto &client = clients[client_idx];
+  client.send_data.emplace_back(std::move(headers), file_fd, offset, length);
+  if(client.send_data.size() == 1) //only starts sending in the case that the queue was empty before this
+    write_front_item(client_idx);
+  return true;
 }
 
 void server<server_type::NON_TLS>::close_connection(int client_idx) {
   auto &client = clients[client_idx];
 
-  if(client.num_write_reqs == 0){ // only erase this client if they haven't got any active write requests
+  if(client.num_write_reqs == 0 && client.sockfd != -1){ // only erase this client if they haven't got any active write requests, and it's not already closed
     active_connections.erase(client_idx);
-    client.send_data = {}; //free up all the data we might have wanted to send
+    client.send_data.clear(); //free up all the data we might have wanted to send
 
-    close(client.sockfd);
+    close_client_socket(client_idx);
+    client.sockfd = -1; //so that closing it again (i.e when that read completes) doesn't close some other fd
+    close_client_pipe(client_idx);
 
     freed_indexes.insert(client_idx);
   }
 }
 
-int server<server_type::NON_TLS>::add_write_req_continued(request *req, int written) { //for long plain HTTP write requests, this writes at the correct offset
-  auto &client = clients[req->client_idx];
-  auto data = client.send_data.front().get_ptr_and_size();
-
-  req->written += written;
-  
-  io_uring_sqe *sqe = io_uring_get_sqe(&ring);
-  io_uring_prep_write(sqe, client.sockfd, &data.buff[req->written], req->total_length - req->written, 0); //do not write at an offset
-  io_uring_sqe_set_data(sqe, req);
-  io_uring_submit(&ring); //submits the event
-  return 0;
-}
-
 void server<server_type::NON_TLS>::req_event_handler(request *&req, int cqe_res){
   switch(req->event){
     case event_type::ACCEPT: {
-      add_tcp_accept_req();
       auto client_idx = setup_client(cqe_res);
 
       active_connections.insert(client_idx);
@@ -98,37 +106,15 @@ void server<server_type::NON_TLS>::req_event_handler(request *&req, int cqe_res)
       break;
     }
     case event_type::READ: {
-      clients[req->client_idx].read_req_active = false;
-      if(read_cb != nullptr) read_cb(req->client_idx, &(req->read_data[0]), cqe_res, this, custom_obj);
+      if(!req->multishot) //multishot reads stay active until the kernel stops them
+        clients[req->client_idx].read_req_active = false;
+      if(read_cb != nullptr) read_cb(req->client_idx, get_read_data(req), cqe_res, this, custom_obj);
       break;
     }
-    case event_type::WRITE: {
-      int broadcast_additional_info = -1; // only used for broadcast messages
-      auto &client = clients[req->client_idx];
-      if(cqe_res + req->written < req->total_length && cqe_res > 0){ //if the current request isn't finished, continue writing
-        int rc = add_write_req_continued(req, cqe_res);
-        req = nullptr; //we don't want to free the req yet
-        if(rc == 0) break;
-      }
-      client.num_write_reqs--; // decrement number of active write requests
-      if(active_connections.count(req->client_idx) && client.id == req->ID){
-        //the above will check specifically if the client is still valid, since in the case that
-        //a new client joins immediately after old one leaves, they might get the same clients
-        //array index, but the ID's would be different
-        auto *queue_ptr = &client.send_data;
-
-        if(queue_ptr->front().broadcast) //if it's broadcast, then custom_info must be the item_idx
-          broadcast_additional_info = queue_ptr->front().custom_info;
-
-        queue_ptr->pop(); //remove the last processed item
-        if(queue_ptr->size() > 0){ //if there's still some data in the queue, write it now
-          auto &data_ref = queue_ptr->front();
-          auto write_data_stuff = data_ref.get_ptr_and_size();
-          add_write_req(req->client_idx, event_type::WRITE, write_data_stuff.buff, write_data_stuff.length); //adds a plain HTTP write request
-        }
-      }
-      if(write_cb != nullptr) write_cb(req->client_idx, broadcast_additional_info, this, custom_obj); //call the write callback
+    case event_type::WRITE:
+    case event_type::SPLICE_IN:
+    case event_type::SPLICE_OUT:
+      plain_write_event(req, cqe_res);
       break;
-    }
   }
 }
\ No newline at end of file
@@ -3,11 +3,21 @@
 
 #include <thread>
 
+#include <netinet/tcp.h> //for TCP_ULP
+#include <linux/tls.h>
+
 using namespace tcp_tls_server;
 
 // define static stuff
 std::vector<server<server_type::TLS>*> server<server_type::TLS>::tls_servers{};
 std::mutex server<server_type::TLS>::tls_server_vector_access{};
+std::shared_ptr<WOLFSSL_CTX> server<server_type::TLS>::wolfssl_ctx{};
+std::mutex server<server_type::TLS>::wolfssl_ctx_lock{};
+std::string server<server_type::TLS>::fullchain_path{};
+std::string server<server_type::TLS>::pkey_path{};
+server_settings server<server_type::TLS>::ctx_settings{};
+ticket_key_store server<server_type::TLS>::ticket_keys{};
+session_stats server<server_type::TLS>::stats{};
 
 void server<server_type::TLS>::kill_all_servers() {
   std::unique_lock<std::mutex> tls_access_lock(tls_server_vector_access);
@@ -17,38 +27,297 @@ void server<server_type::TLS>::kill_all_servers() {
 
 void server<server_type::TLS>::close_connection(int client_idx) {
   auto &client = clients[client_idx];
-  if(client.num_write_reqs == 0){
-    wolfSSL_shutdown(client.ssl);
+  if(client.num_write_reqs == 0 && client.sockfd != -1){
+    if(!client.ktls) //the kernel has the session now, so wolfSSL can't send anything on it
+      wolfSSL_shutdown(client.ssl);
     wolfSSL_free(client.ssl);
 
-    close(client.sockfd);
+    close_client_socket(client_idx);
+    client.sockfd = -1; //so that closing it again (i.e when that read completes) doesn't close some other fd
+    close_client_pipe(client_idx);
 
     client.ssl = nullptr; //so that if we try to close multiple times, free() won't crash on it, inside of wolfSSL_free()
     active_connections.erase(client_idx);
-    client.send_data = {}; //free up all the data we might have wanted to send
+    client.send_data.clear(); //free up all the data we might have wanted to send
 
     freed_indexes.insert(client_idx);
   }
 }
 
 void server<server_type::TLS>::write_connection(int client_idx, std::vector<char> &&buff) {
+  clients[client_idx].send_data.emplace_back(std::move(buff));
+  send_new_item(client_idx);
+}
+
+void server<server_type::TLS>::write_connection(int client_idx, const char *buff, size_t length, std::shared_ptr<const void> owner) {
   auto &client = clients[client_idx];
-  client.send_data.emplace(std::move(buff));
-  const auto &data_ref = client.send_data.front();
-  auto &to_write_buff = data_ref.buff;
-  
-  if(client.send_data.size() == 1) //only do wolfSSL_write() if this is the only thing to write
-    wolfSSL_write(client.ssl, &to_write_buff[0], to_write_buff.size()); //writes the data using wolfSSL
+  client.send_data.emplace_back(buff, length);
+  client.send_data.back().owner = std::move(owner);
+  send_new_item(client_idx);
 }
 
-void server<server_type::TLS>::write_connection(int client_idx, char *buff, size_t length) {
+void server<server_type::TLS>::write_connection(int client_idx, std::vector<char> &&head, const char *buff, size_t length, std::shared_ptr<const void> owner) {
   auto &client = clients[client_idx];
-  client.send_data.emplace(buff, length);
-  const auto &data_ref = client.send_data.front();
-  auto &to_write_buff = data_ref.ptr_buff;
-  
-  if(client.send_data.size() == 1) //only do wolfSSL_write() if this is the only thing to write
-    wolfSSL_write(client.ssl, to_write_buff, length); //writes the data using wolfSSL
+  client.send_data.emplace_back(std::move(head), buff, length);
+  client.send_data.back().owner = std::move(owner);
+  send_new_item(client_idx);
+}
+
+void server<server_type::TLS>::write_connection(int client_idx, const char *head, size_t head_length, const char *buff, size_t length, std::shared_ptr<const void> owner) {
+  auto &client = clients[client_idx];
+  client.send_data.emplace_back(head, head_length, buff, length);
+  client.send_data.back().owner = std::move(owner);
+  send_new_item(client_idx);
+}
+
+void server<server_type::TLS>::encrypt_send_data(int client_idx) {
+  auto &client = clients[client_idx];
+  for(auto &item : client.send_data){
+    if(item.tls_end != UINT64_MAX) //already all encrypted, and waiting to be written
+      continue;
+
+    const auto head = item.has_head() ? item.get_head() : write_data::ptr_and_size(nullptr, 0);
+    const auto data = item.get_ptr_and_size();
+    const size_t total = head.length + data.length;
+    while(item.tls_encrypted < total){
+      const size_t waiting = client.tls_out.size() + client.tls_out_writing.size() - client.tls_out_written;
+      if(waiting >= TLS_OUTPUT_LIMIT) //the rest is encrypted as the output is written
+        return;
+
+      const bool in_head = item.tls_encrypted < head.length;
+      const char *segment = in_head ? head.buff + item.tls_encrypted : data.buff + (item.tls_encrypted - head.length);
+      const size_t segment_left = in_head ? head.length - item.tls_encrypted : total - item.tls_encrypted;
+      const int encrypted = wolfSSL_write(client.ssl, segment, std::min(segment_left, TLS_OUTPUT_LIMIT - waiting)); //the send callback never blocks, so it's all done now
+      if(encrypted <= 0) //wolfSSL has failed, so nothing more can be sent on this connection
+        return;
+      item.tls_encrypted += encrypted;
+    }
+    item.tls_end = client.encrypted_total;
+  }
+}
+
+namespace {
+  union ktls_crypto_info { //whichever of the kernel's descriptions matches the session's cipher
+    tls12_crypto_info_aes_gcm_128 aes_gcm_128;
+    tls12_crypto_info_aes_gcm_256 aes_gcm_256;
+    tls12_crypto_info_chacha20_poly1305 chacha20_poly1305;
+  };
+
+  template<typename C>
+  socklen_t fill_crypto_info(C &crypto, uint16_t cipher_type, const unsigned char *key, const unsigned char *iv, const unsigned char *rec_seq){
+    crypto.info.version = TLS_1_3_VERSION;
+    crypto.info.cipher_type = cipher_type;
+    std::memcpy(crypto.key, key, sizeof(crypto.key));
+    std::memcpy(crypto.salt, iv, sizeof(crypto.salt)); //TLS 1.3's 12 byte IV is the kernel's salt followed by its IV (ChaCha20 has no salt)
+    std::memcpy(crypto.iv, iv + sizeof(crypto.salt), sizeof(crypto.iv));
+    std::memcpy(crypto.rec_seq, rec_seq, sizeof(crypto.rec_seq));
+    return sizeof(crypto);
+  }
+
+  //fills in info with the session's keys for one direction, returning its size, or 0 if the kernel can't use the session's cipher
+  socklen_t get_ktls_crypto_info(WOLFSSL *ssl, int direction, ktls_crypto_info &info){
+    const bool tx = direction == TLS_TX; //the server's keys encrypt what it sends, and the client's decrypt what it receives
+    const unsigned char *key = tx ? wolfSSL_GetServerWriteKey(ssl) : wolfSSL_GetClientWriteKey(ssl);
+    const unsigned char *iv = tx ? wolfSSL_GetServerWriteIV(ssl) : wolfSSL_GetClientWriteIV(ssl);
+    word64 seq{};
+    if(!key || !iv || (tx ? wolfSSL_GetSequenceNumber(ssl, &seq) : wolfSSL_GetPeerSequenceNumber(ssl, &seq)) < 0)
+      return 0;
+
+    unsigned char rec_seq[8]; //the next record's sequence number, big endian
+    for(int i = 7; i >= 0; i--, seq >>= 8)
+      rec_seq[i] = seq & 0xff;
+
+    std::memset(&info, 0, sizeof(info));
+    const int cipher = wolfSSL_GetBulkCipher(ssl);
+    const int key_size = wolfSSL_GetKeySize(ssl);
+    if(cipher == wolfssl_aes_gcm && key_size == TLS_CIPHER_AES_GCM_128_KEY_SIZE)
+      return fill_crypto_info(info.aes_gcm_128, TLS_CIPHER_AES_GCM_128, key, iv, rec_seq);
+    if(cipher == wolfssl_aes_gcm && key_size == TLS_CIPHER_AES_GCM_256_KEY_SIZE)
+      return fill_crypto_info(info.aes_gcm_256, TLS_CIPHER_AES_GCM_256, key, iv, rec_seq);
+    if(cipher == wolfssl_chacha)
+      return fill_crypto_info(info.chacha20_poly1305, TLS_CIPHER_CHACHA20_POLY1305, key, iv, rec_seq);
+    return 0;
+  }
+}
+
+bool server<server_type::TLS>::install_ktls_keys(int client_idx, int direction) {
+  auto &client = clients[client_idx];
+  ktls_crypto_info info;
+  const auto length = get_ktls_crypto_info(client.ssl, direction, info);
+  if(length == 0)
+    return false;
+
+  //receiving is always set up first, which is when the socket is switched to the kernel's TLS, it carries on as plain TCP until it has keys
+  if(direction == TLS_RX && setsockopt(client.sockfd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == -1)
+    return false; //i.e the tls module isn't loaded
+
+  const bool installed = setsockopt(client.sockfd, SOL_TLS, direction, &info, length) == 0;
+  std::memset(&info, 0, sizeof(info)); //so the keys aren't left lying around
+  return installed;
+}
+
+void server<server_type::TLS>::start_ktls(int client_idx) {
+  auto &client = clients[client_idx];
+  client.ktls_rx = install_ktls_keys(client_idx, TLS_RX); //if it can't, the connection just carries on through wolfSSL
+  client.ktls_tx_pending = client.ktls_rx;
+  finish_ktls(client_idx);
+}
+
+void server<server_type::TLS>::finish_ktls(int client_idx) {
+  auto &client = clients[client_idx];
+  //anything wolfSSL has encrypted (i.e session tickets) has to be written first, since the kernel would encrypt it again
+  if(!client.ktls_tx_pending || client.send_data.size() || client.tls_out.size() || client.tls_out_writing.size())
+    return;
+
+  client.ktls_tx_pending = false;
+  client.ktls = install_ktls_keys(client_idx, TLS_TX);
+}
+
+void server<server_type::TLS>::queue_flush(int client_idx) {
+  auto &client = clients[client_idx];
+  if(!client.flush_queued){
+    client.flush_queued = true;
+    clients_to_flush.push_back(client_idx);
+  }
+}
+
+void server<server_type::TLS>::flush_pending_writes() {
+  for(const auto client_idx : clients_to_flush){
+    auto &client = clients[client_idx];
+    if(!client.flush_queued) //it was replaced by a new client since it was queued
+      continue;
+    client.flush_queued = false;
+
+    //if it's closed there's no one to write to, and if a write is in flight, this is flushed again once it's done
+    if(client.sockfd == -1 || client.tls_out_writing.size() || client.tls_out.empty())
+      continue;
+
+    std::swap(client.tls_out, client.tls_out_writing); //tls_out gets the last buffer written, so its memory is reused
+    client.tls_out_written = 0;
+    const auto event = active_connections.count(client_idx) ? event_type::WRITE : event_type::ACCEPT_WRITE;
+    add_write_req(client_idx, event, client.tls_out_writing.data(), client.tls_out_writing.size());
+  }
+  clients_to_flush.clear();
+}
+
+void server<server_type::TLS>::complete_written_items(int client_idx) {
+  auto &client = clients[client_idx];
+  const auto id = client.id;
+
+  completed_broadcast_info.clear();
+  while(client.send_data.size() && client.send_data.front().tls_end <= client.written_total){
+    auto &item = client.send_data.front();
+    completed_broadcast_info.push_back(item.broadcast ? item.custom_info : -1); //if it's broadcast, then custom_info must be the item_idx
+    client.send_data.pop_front();
+  }
+
+  encrypt_send_data(client_idx); //there's room in the output for more
+  finish_ktls(client_idx);
+
+  if(write_cb == nullptr) return;
+  for(const auto broadcast_additional_info : completed_broadcast_info){
+    if(!active_connections.count(client_idx) || clients[client_idx].id != id) //closed by an earlier write callback, so the rest are for nothing
+      break;
+    write_cb(client_idx, broadcast_additional_info, this, custom_obj);
+  }
+}
+
+bool server<server_type::TLS>::write_file_connection(int client_idx, int file_fd, size_t offset, size_t length, std::vector<char> &&headers) {
+  auto &client = clients[client_idx];
+  if(!client.ktls) //the file has to go through wolfSSL, so it can't be spliced straight to the socket
+    return false;
+
+  client.send_data.emplace_back(std::move(headers), file_fd, offset, length);
+  if(client.send_data.size() == 1) //the kernel encrypts it on the way out, so it's spliced the same as for a plain client
+    write_front_item(client_idx);
+  return true;
+}
+
+int server<server_type::TLS>::decrypt_received(int client_idx) {
+  auto &client = clients[client_idx];
+  int total_read = 0;
+  while(client.recv_data.size() || wolfSSL_pending(client.ssl)){ //stops once wolfSSL needs more than it has for the next record
+    if(plaintext.size() - total_read < READ_SIZE)
+      plaintext.resize(total_read + READ_SIZE); //a record never decrypts to more than it took up
+    const int this_time = wolfSSL_read(client.ssl, &plaintext[total_read], plaintext.size() - total_read);
+    if(this_time <= 0) break;
+    total_read += this_time;
+  }
+  return total_read;
+}
+
+int server<server_type::TLS>::read_early_data(int client_idx, bool &ended) {
+  auto &client = clients[client_idx];
+  int total_read = 0;
+  ended = false;
+  while(true){
+    if(plaintext.size() - total_read < READ_SIZE)
+      plaintext.resize(total_read + READ_SIZE);
+    int this_time = 0;
+    //this also carries on the handshake up to the server's Finished, and returns 0 once there's no more early data to come
+    const int ret = wolfSSL_read_early_data(client.ssl, &plaintext[total_read], plaintext.size() - total_read, &this_time);
+    if(ret < 0){
+      ended = wolfSSL_get_error(client.ssl, ret) != WOLFSSL_ERROR_WANT_READ; //so the accept fails with it
+      break;
+    }
+    if(this_time <= 0){
+      ended = true;
+      break;
+    }
+    total_read += this_time;
+  }
+  return total_read;
+}
+
+void server<server_type::TLS>::continue_handshake(int client_idx) {
+  const auto id = clients[client_idx].id;
+  const auto ssl = clients[client_idx].ssl;
+  bool early_data_ended = true;
+  const int early_read = settings.max_early_data ? read_early_data(client_idx, early_data_ended) : 0;
+  const bool finished = early_data_ended && wolfSSL_accept(ssl) == 1;
+
+  //early data is given to the read callback now, so the response goes with the server's half of the handshake, rather than a round trip later
+  if(early_read > 0){
+    clients[client_idx].early_data = true;
+    if(!active_connections.count(client_idx)){
+      if(accept_cb != nullptr) accept_cb(client_idx, this, custom_obj);
+      active_connections.insert(client_idx);
+    }
+    if(read_cb != nullptr) read_cb(client_idx, &plaintext[0], early_read, this, custom_obj);
+    if(!active_connections.count(client_idx) || clients[client_idx].id != id) //closed by the read callback
+      return;
+  }
+  if(!finished) //wolfSSL has already asked for more to be read
+    return;
+
+  auto &client = clients[client_idx];
+  const bool resumed = wolfSSL_session_reused(ssl);
+  (resumed ? stats.resumed_handshakes : stats.full_handshakes)++;
+  if(client.early_data){
+    stats.early_data_handshakes++;
+    client.early_data = false; //anything from now on was sent after the handshake, so it can't be a replay
+  }else{
+    if(accept_cb != nullptr) accept_cb(client_idx, this, custom_obj);
+    active_connections.insert(client_idx);
+  }
+
+  //we might have got the HTTP request with the handshake, otherwise it's read as normal
+  const int total_read = decrypt_received(client_idx);
+  if(total_read == 0)
+    add_read_req(client_idx, event_type::READ);
+
+  if(use_ktls && client.recv_data.empty() && wolfSSL_pending(ssl) == 0) //everything received so far has been decrypted and taken, so the kernel can carry on from here
+    start_ktls(client_idx);
+  if(total_read > 0 && read_cb != nullptr)
+    read_cb(client_idx, &plaintext[0], total_read, this, custom_obj);
+}
+
+void server<server_type::TLS>::send_new_item(int client_idx) {
+  auto &client = clients[client_idx];
+  if(!client.ktls)
+    encrypt_send_data(client_idx); //if earlier items are still waiting for room, this waits behind them
+  else if(client.send_data.size() == 1) //only adds a write request in the case that the queue was empty before this, otherwise it's gathered into the next one
+    write_front_item(client_idx);
 }
 
 server<server_type::TLS>::server(
@@ -61,8 +330,9 @@ server<server_type::TLS>::server(
   read_callback<server_type::TLS> r_cb,
   write_callback<server_type::TLS> w_cb,
   event_callback<server_type::TLS> e_cb,
-  custom_read_callback<server_type::TLS> cr_cb
-) : server_base<server_type::TLS>(listen_port) { //call parent constructor with the port to listen on
+  custom_read_callback<server_type::TLS> cr_cb,
+  const server_settings &settings
+) : server_base<server_type::TLS>(listen_port, settings) { //call parent constructor with the port to listen on
   this->accept_cb = a_cb;
   this->close_cb = c_cb;
   this->read_cb = r_cb;
@@ -71,33 +341,84 @@ server<server_type::TLS>::server(
   this->custom_read_cb = cr_cb;
   this->custom_obj = custom_obj;
 
-  //initialise wolfSSL
-  wolfSSL_Init();
+  {
+    std::lock_guard<std::mutex> ctx_guard(wolfssl_ctx_lock);
+    if(!std::atomic_load(&wolfssl_ctx)){ //the first TLS server sets up wolfSSL and the context, which every other thread uses
+      wolfSSL_Init();
+      fullchain_path = fullchain_location;
+      pkey_path = pkey_location;
+      ctx_settings = settings;
+
+      const char *error = nullptr;
+      WOLFSSL_CTX *ctx = make_wolfssl_ctx(error);
+      if(ctx == nullptr)
+        utility::fatal_error(error);
+      std::atomic_store(&wolfssl_ctx, std::shared_ptr<WOLFSSL_CTX>(ctx, wolfSSL_CTX_free));
+    }
+  }
+
+  if(settings.ktls && fixed_files) //a fixed file isn't an fd, so setsockopt can't be used on it
+    std::cerr << "kTLS can't be used with fixed files, so it won't be used" << std::endl;
+  else
+    use_ktls = settings.ktls;
 
-  //create the wolfSSL context
-  if((wolfssl_ctx = wolfSSL_CTX_new(wolfTLSv1_3_server_method())) == NULL)
-    utility::fatal_error("Failed to create the WOLFSSL_CTX");
+  std::unique_lock<std::mutex> access_lock(tls_server_vector_access);
+  tls_servers.push_back(this); // basically so that anything which wants to manage all of the server at once, can
+}
 
-  //load the server certificate
-  if(wolfSSL_CTX_use_certificate_chain_file(wolfssl_ctx, fullchain_location.c_str()) != SSL_SUCCESS)
-    utility::fatal_error("Failed to load the certificate files");
+WOLFSSL_CTX *server<server_type::TLS>::make_wolfssl_ctx(const char *&error){
+  WOLFSSL_CTX *ctx = wolfSSL_CTX_new(wolfTLSv1_3_server_method());
+  if(ctx == nullptr){
+    error = "Failed to create the WOLFSSL_CTX";
+    return nullptr;
+  }
+
+  //load the server certificate and its private key, which have to match, since they could be caught halfway through being replaced
+  if(wolfSSL_CTX_use_certificate_chain_file(ctx, fullchain_path.c_str()) != SSL_SUCCESS)
+    error = "Failed to load the certificate files";
+  else if(wolfSSL_CTX_use_PrivateKey_file(ctx, pkey_path.c_str(), SSL_FILETYPE_PEM) != SSL_SUCCESS)
+    error = "Failed to load the private key file";
+  else if(wolfSSL_CTX_check_private_key(ctx) != SSL_SUCCESS)
+    error = "The private key doesn't match the certificate";
+  if(error != nullptr){
+    wolfSSL_CTX_free(ctx);
+    return nullptr;
+  }
 
-  //load the server's private key
-  if(wolfSSL_CTX_use_PrivateKey_file(wolfssl_ctx, pkey_location.c_str(), SSL_FILETYPE_PEM) != SSL_SUCCESS)
-    utility::fatal_error("Failed to load the private key file");
-  
   //set the wolfSSL callbacks
-  wolfSSL_CTX_SetIORecv(wolfssl_ctx, tls_recv);
-  wolfSSL_CTX_SetIOSend(wolfssl_ctx, tls_send);
+  wolfSSL_CTX_SetIORecv(ctx, tls_recv);
+  wolfSSL_CTX_SetIOSend(ctx, tls_send);
+
+  if(ctx_settings.session_tickets){ //stateless, the session is in the ticket, which only the servers can decrypt
+    wolfSSL_CTX_set_TicketEncCb(ctx, ticket_encryption_cb);
+    wolfSSL_CTX_set_TicketEncCtx(ctx, &ticket_keys); //the keys outlive any context, so tickets still work after a reload
+    wolfSSL_CTX_set_TicketHint(ctx, TICKET_KEY_LIFETIME); //a ticket is accepted for at least this long
+    if(ctx_settings.max_early_data)
+      wolfSSL_CTX_set_max_early_data(ctx, ctx_settings.max_early_data);
+  }
+  return ctx;
+}
 
-  std::unique_lock<std::mutex> access_lock(tls_server_vector_access);
-  tls_servers.push_back(this); // basically so that anything which wants to manage all of the server at once, can
+bool server<server_type::TLS>::reload_certificates(){
+  std::lock_guard<std::mutex> ctx_guard(wolfssl_ctx_lock);
+  if(!std::atomic_load(&wolfssl_ctx)) //there aren't any TLS servers
+    return false;
+
+  const char *error = nullptr;
+  WOLFSSL_CTX *ctx = make_wolfssl_ctx(error);
+  if(ctx == nullptr){
+    std::cerr << error << ", so the old certificates are still used" << std::endl;
+    return false;
+  }
+  std::atomic_store(&wolfssl_ctx, std::shared_ptr<WOLFSSL_CTX>(ctx, wolfSSL_CTX_free));
+  return true;
 }
 
 void server<server_type::TLS>::tls_accept(int client_idx){
   auto *client = &clients[client_idx];
 
-  WOLFSSL *ssl = wolfSSL_new(wolfssl_ctx);
+  const auto ctx = std::atomic_load(&wolfssl_ctx); //keeps it alive until the session has its own reference
+  WOLFSSL *ssl = wolfSSL_new(ctx.get());
   wolfSSL_set_fd(ssl, client_idx); //not actually the fd but it's useful to us
 
   wolfSSL_SetIOReadCtx(ssl, this);
@@ -112,7 +433,6 @@ void server<server_type::TLS>::req_event_handler(request *&req, int cqe_res){
   switch(req->event){
     case event_type::ACCEPT: {
       auto client_idx = setup_client(cqe_res);
-      add_tcp_accept_req();
       tls_accept(client_idx);
       break;
     }
@@ -120,95 +440,56 @@ void server<server_type::TLS>::req_event_handler(request *&req, int cqe_res){
       auto &client = clients[req->client_idx];
       client.read_req_active = false;
 
-      const auto &ssl = client.ssl;
-      if(client.recv_data.size() == 0) { //if there is no data in the buffer, add it
-        client.recv_data = std::move(req->read_data);
-        client.recv_data.resize(cqe_res);
-      }else{ //otherwise copy the new data to the end of the old data
-        auto *vec = &client.recv_data;
-        vec->insert(vec->end(), &(req->read_data[0]), &(req->read_data[0]) + cqe_res);
-      }
-      if(wolfSSL_accept(ssl) == 1){ //that means the connection was successfully established
-        if(accept_cb != nullptr) accept_cb(req->client_idx, this, custom_obj);
-        active_connections.insert(req->client_idx);
-
-        auto &data = client.recv_data; //the data vector
-        const auto recvd_amount = data.size();
-        std::vector<char> buffer(READ_SIZE);
-        auto amount_read = wolfSSL_read(ssl, &buffer[0], READ_SIZE);
-
-        //above will either add in a read request, or get whatever is left in the local buffer (as we might have got the HTTP request with the handshake)
-
-        client.recv_data = std::vector<char>{};
-        if(amount_read > -1){
-          clients[req->client_idx].read_req_active = false;
-          if(read_cb != nullptr) read_cb(req->client_idx, &buffer[0], amount_read, this, custom_obj);
-        }
-      }
+      client.recv_data.append(&(req->read_data[0]), cqe_res);
+      continue_handshake(req->client_idx);
       break;
     }
-    case event_type::ACCEPT_WRITE: { //used only for when wolfSSL needs to write data during the TLS handshake
-      auto &client = clients[req->client_idx];
-      client.num_write_reqs--; // decrement number of active write requests
-      client.accept_last_written = cqe_res; //this is the amount that was last written, used in the tls_write callback
-      wolfSSL_accept(client.ssl); //call accept again
+    case event_type::SPLICE_IN:
+    case event_type::SPLICE_OUT:
+      plain_write_event(req, cqe_res);
       break;
-    }
-    case event_type::WRITE: { //used for generally writing over TLS
-      int broadcast_additional_info = -1; // only used for broadcast messages
+    case event_type::ACCEPT_WRITE: //the handshake's records, the handshake itself carries on once the client replies
+    case event_type::WRITE: { //some of the client's encrypted output has been written
       auto &client = clients[req->client_idx];
+      if(client.ktls){ //what was written is plain data, the kernel encrypted it
+        plain_write_event(req, cqe_res);
+        break;
+      }
       client.num_write_reqs--; // decrement number of active write requests
-      if(client.send_data.size() > 0){ //ensure this connection is still active
-        auto &data_ref = client.send_data.front();
-        auto write_data_stuff = data_ref.get_ptr_and_size();
-        data_ref.last_written = cqe_res;
-
-        int written = wolfSSL_write(client.ssl, write_data_stuff.buff, write_data_stuff.length);
-        if(written > -1){ //if it's not negative, it's all been written, so this write call is done
-          if(client.send_data.front().broadcast) //if it's broadcast, then custom_info must be the item_idx
-            broadcast_additional_info = client.send_data.front().custom_info;
-
-          client.send_data.pop();
-          if(write_cb != nullptr) write_cb(req->client_idx, broadcast_additional_info, this, custom_obj);
-          if(client.send_data.size()){ //if the write queue isn't empty, then write that as well
-            auto &data_ref = client.send_data.front();
-            auto write_data_stuff = data_ref.get_ptr_and_size();
-            wolfSSL_write(client.ssl, write_data_stuff.buff, write_data_stuff.length);
-          }
-        }
+      client.tls_out_written += cqe_res;
+      client.written_total += cqe_res;
+
+      if(client.tls_out_written < client.tls_out_writing.size()){ //only some of it was written, so the rest is written from where it got to
+        add_write_req(req->client_idx, req->event, &client.tls_out_writing[client.tls_out_written], client.tls_out_writing.size() - client.tls_out_written);
+      }else{
+        client.tls_out_writing.clear();
+        if(client.tls_out.size()) //records made while this was being written
+          queue_flush(req->client_idx);
       }
+
+      complete_written_items(req->client_idx);
       break;
     }
     case event_type::READ: { //used for reading over TLS
       auto &client = clients[req->client_idx];
       client.read_req_active = false;
 
-      int to_read_amount = cqe_res; //the default read size
-      if(client.recv_data.size()) { //will correctly deal with needing to call wolfSSL_read multiple times
-        auto &vec_member = client.recv_data;
-        vec_member.insert(vec_member.end(), &(req->read_data[0]), &(req->read_data[0]) + cqe_res);
-        to_read_amount = vec_member.size(); //the read amount has got to be bigger, since the pending data could be more than READ_SIZE
-      }else{
-        client.recv_data = std::move(req->read_data);
-        client.recv_data.resize(cqe_res);
+      if(client.ktls_rx){ //the kernel has already decrypted it
+        if(read_cb != nullptr) read_cb(req->client_idx, get_read_data(req), cqe_res, this, custom_obj);
+        break;
       }
 
-      std::vector<char> buffer(to_read_amount);
-      int total_read = 0;
-
-      while(client.recv_data.size()){
-        int this_time = wolfSSL_read(client.ssl, &buffer[total_read], to_read_amount - total_read);
-        if(this_time <= 0) break;
-        total_read += this_time;
+      client.recv_data.append(&(req->read_data[0]), cqe_res);
+      if(client.early_data){ //the rest of the handshake, or more early data
+        continue_handshake(req->client_idx);
+        break;
       }
+      const int total_read = decrypt_received(req->client_idx);
 
       if(total_read == 0) add_read_req(req->client_idx, event_type::READ); //total_read of 0 implies that data must be read into the recv_data buffer
       
-      if(total_read > 0){
-        if(read_cb != nullptr) read_cb(req->client_idx, &buffer[0], total_read, this, custom_obj);
-        if(!client.recv_data.size())
-          client.recv_data = {};
-      }
+      if(total_read > 0 && read_cb != nullptr)
+        read_cb(req->client_idx, &plaintext[0], total_read, this, custom_obj);
       break;
     }
   }
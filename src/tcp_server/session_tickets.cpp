@@ -0,0 +1,83 @@
+#include "../header/session_tickets.h"
+
+#include <cstring>
+
+#include <sys/random.h>
+
+#include <wolfssl/wolfcrypt/chacha20_poly1305.h>
+
+using namespace tcp_tls_server;
+
+namespace {
+  bool fill_random(unsigned char *buff, size_t length){ //small requests from getrandom are never cut short once it's initialised
+    return getrandom(buff, length, 0) == (ssize_t)length;
+  }
+}
+
+bool ticket_key_store::encryption_key(ticket_key &key){
+  std::lock_guard<std::mutex> guard(lock);
+  const auto now = time(nullptr);
+  if(!has_current || now - current.created >= TICKET_KEY_LIFETIME){
+    ticket_key next{};
+    if(!fill_random(next.name, sizeof(next.name)) || !fill_random(next.key, sizeof(next.key)))
+      return false;
+    next.created = now;
+
+    previous = current;
+    has_previous = has_current;
+    current = next;
+    has_current = true;
+    std::memset(next.key, 0, sizeof(next.key));
+  }
+  key = current;
+  return true;
+}
+
+bool ticket_key_store::decryption_key(const unsigned char *name, ticket_key &key, bool &renew){
+  std::lock_guard<std::mutex> guard(lock);
+  if(has_current && std::memcmp(name, current.name, sizeof(current.name)) == 0){
+    key = current;
+    renew = false;
+    return true;
+  }
+  //the previous key was replaced once it was TICKET_KEY_LIFETIME old, so it's kept for another TICKET_KEY_LIFETIME after that,
+  //which is at least TICKET_KEY_LIFETIME (the ticket hint) from the last ticket it made, tickets it made earlier are accepted for longer
+  if(has_previous && std::memcmp(name, previous.name, sizeof(previous.name)) == 0 && time(nullptr) - previous.created < TICKET_KEY_LIFETIME * 2){
+    key = previous;
+    renew = true;
+    return true;
+  }
+  return false;
+}
+
+int tcp_tls_server::ticket_encryption_cb(WOLFSSL *ssl, unsigned char key_name[WOLFSSL_TICKET_NAME_SZ], unsigned char iv[WOLFSSL_TICKET_IV_SZ],
+  unsigned char mac[WOLFSSL_TICKET_MAC_SZ], int enc, unsigned char *ticket, int in_length, int *out_length, void *ctx){
+  auto *keys = (ticket_key_store*)ctx;
+  ticket_key_store::ticket_key key;
+  bool renew = false;
+
+  if(enc){
+    //all of the IV is sent with the ticket, though only the first CHACHA20_POLY1305_AEAD_IV_SIZE bytes are used
+    if(!keys->encryption_key(key) || !fill_random(iv, WOLFSSL_TICKET_IV_SZ))
+      return WOLFSSL_TICKET_RET_FATAL;
+    std::memcpy(key_name, key.name, WOLFSSL_TICKET_NAME_SZ);
+    std::memset(mac, 0, WOLFSSL_TICKET_MAC_SZ); //the tag only fills the start of it, and the rest is sent too
+  }else if(!keys->decryption_key(key_name, key, renew)){
+    return WOLFSSL_TICKET_RET_REJECT; //its key has expired, so the client does a full handshake, and gets a new ticket
+  }
+
+  unsigned char aad[WOLFSSL_TICKET_NAME_SZ + CHACHA20_POLY1305_AEAD_IV_SIZE]; //so neither can be swapped for another ticket's
+  std::memcpy(aad, key_name, WOLFSSL_TICKET_NAME_SZ);
+  std::memcpy(aad + WOLFSSL_TICKET_NAME_SZ, iv, CHACHA20_POLY1305_AEAD_IV_SIZE);
+
+  //only the first CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE bytes of the mac are used
+  const int ret = enc ?
+    wc_ChaCha20Poly1305_Encrypt(key.key, iv, aad, sizeof(aad), ticket, in_length, ticket, mac) :
+    wc_ChaCha20Poly1305_Decrypt(key.key, iv, aad, sizeof(aad), ticket, in_length, mac, ticket);
+  std::memset(key.key, 0, sizeof(key.key)); //so the key isn't left lying around
+
+  if(ret != 0)
+    return enc ? WOLFSSL_TICKET_RET_FATAL : WOLFSSL_TICKET_RET_REJECT; //a ticket which doesn't decrypt has been tampered with
+  *out_length = in_length;
+  return renew ? WOLFSSL_TICKET_RET_CREATE : WOLFSSL_TICKET_RET_OK;
+}
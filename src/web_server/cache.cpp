@@ -0,0 +1,306 @@
+#include "../header/web_server/cache.h"
+
+#include <zlib.h>
+#include <csignal>
+#include <atomic>
+
+using namespace web_cache;
+
+namespace {
+  //every mapped file body, so the SIGBUS handler knows which faults are from truncated files, it's locked with a spinlock
+  //rather than a mutex, since it's also taken in the handler, the faulting thread never holds it, as it doesn't touch the mappings
+  std::atomic_flag mappings_lock = ATOMIC_FLAG_INIT;
+  std::vector<std::pair<uintptr_t, size_t>> mappings{};
+  uintptr_t page_size{};
+
+  void lock_mappings(){ while(mappings_lock.test_and_set(std::memory_order_acquire)); }
+  void unlock_mappings(){ mappings_lock.clear(std::memory_order_release); }
+
+  void sigbus_handler(int sig_number, siginfo_t *info, void*){
+    const auto address = (uintptr_t)info->si_addr;
+    bool truncated = false;
+    if(info->si_code == BUS_ADRERR){ //a page past the end of a mapped file
+      lock_mappings();
+      for(const auto &mapping : mappings)
+        truncated |= address >= mapping.first && address < mapping.first + mapping.second;
+      unlock_mappings();
+    }
+
+    //the page is swapped for a zeroed one, and the read which faulted carries on from it
+    const auto page = (void*)(address & ~(page_size - 1));
+    if(truncated && mmap(page, page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED)
+      return;
+
+    signal(sig_number, SIG_DFL); //anything else is a real crash
+    raise(sig_number);
+  }
+
+  void install_sigbus_handler(){
+    page_size = sysconf(_SC_PAGESIZE);
+    struct sigaction action{};
+    action.sa_sigaction = sigbus_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, nullptr);
+  }
+}
+
+file_body file_body::map_file(int file_fd, size_t length){
+  static std::once_flag handler_installed{};
+  file_body body{};
+  if(length == 0) //mmap can't map nothing
+    return body;
+
+  std::call_once(handler_installed, install_sigbus_handler);
+  void *mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, file_fd, 0);
+  if(mapping == MAP_FAILED)
+    return body;
+
+  lock_mappings();
+  mappings.emplace_back((uintptr_t)mapping, length);
+  unlock_mappings();
+
+  madvise(mapping, length, MADV_WILLNEED); //starts reading it in now, without waiting for it
+  if(length >= HUGE_PAGE_SIZE)
+    madvise(mapping, length, MADV_HUGEPAGE); //only works if the filesystem supports it, otherwise it's ignored
+
+  body.mapping = mapping;
+  body.mapped_length = length;
+  return body;
+}
+
+void file_body::unmap(){
+  lock_mappings();
+  for(auto &entry : mappings){
+    if(entry.first == (uintptr_t)mapping){
+      entry = mappings.back();
+      mappings.pop_back();
+      break;
+    }
+  }
+  unlock_mappings();
+  munmap(mapping, mapped_length); //including any zeroed pages mapped over it
+}
+
+cache::shard &cache::get_shard(const std::string &filepath){
+  return shards[std::hash<std::string>()(filepath) % CACHE_SHARDS];
+}
+
+void cache::set_capacity(size_t bytes){
+  shard_capacity = bytes / CACHE_SHARDS;
+}
+
+void cache::remove_node(shard &s, node_map::iterator node_it){
+  auto &node = node_it->second;
+  const auto size = node.size();
+  if(node.is_protected){
+    s.protected_items.erase(node.position);
+    s.protected_bytes -= size;
+  }else{
+    s.probation.erase(node.position);
+    s.probation_bytes -= size;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(watch_lock);
+    auto watch_it = watch_to_filepaths.find(node.watch);
+    if(watch_it != watch_to_filepaths.end()){
+      watch_it->second.erase(node_it->first);
+      if(watch_it->second.empty()){ //the watch is only removed once no other path to the same file (i.e public//a.js) is cached
+        watch_to_filepaths.erase(watch_it);
+        inotify_rm_watch(inotify_fd, node.watch); //fails harmlessly if the kernel already removed it (i.e the file was deleted)
+      }
+    }
+  }
+
+  s.items.erase(node_it); //anyone still sending the entry has their own reference to it
+}
+
+void cache::promote(shard &s, cache_node &node){
+  const auto size = node.size();
+  if(node.is_protected){ //already protected, so just make it the most recently used
+    s.protected_items.splice(s.protected_items.begin(), s.protected_items, node.position);
+    return;
+  }
+
+  s.protected_items.splice(s.protected_items.begin(), s.probation, node.position); //iterators stay valid when spliced
+  s.probation_bytes -= size;
+  s.protected_bytes += size;
+  node.is_protected = true;
+
+  //if the protected segment is too big, its least recently used items get another chance in probation
+  const size_t protected_capacity = shard_capacity / 100 * PROTECTED_PERCENT;
+  while(s.protected_bytes > protected_capacity && s.protected_items.size() > 1){
+    auto &demoted = s.items.find(*s.protected_items.back())->second;
+    const auto demoted_size = demoted.size();
+    s.probation.splice(s.probation.begin(), s.protected_items, demoted.position);
+    s.protected_bytes -= demoted_size;
+    s.probation_bytes += demoted_size;
+    demoted.is_protected = false;
+  }
+}
+
+cache_entry_ptr cache::fetch_item(const std::string &filepath, cache_entry_ptr *compressed){
+  auto &s = get_shard(filepath);
+  std::lock_guard<std::mutex> guard(s.lock);
+
+  auto node_it = s.items.find(filepath);
+  if(node_it == s.items.end())
+    return nullptr;
+
+  promote(s, node_it->second);
+  if(compressed)
+    *compressed = node_it->second.compressed;
+  return node_it->second.entry;
+}
+
+bool cache::insert_item(const std::string &filepath, const cache_entry_ptr &entry){
+  const auto size = entry->size();
+
+  if(size > shard_capacity) //too big to ever fit, so it's just sent
+    return false;
+
+  auto &s = get_shard(filepath);
+  std::lock_guard<std::mutex> guard(s.lock);
+
+  if(s.items.count(filepath)) //another thread cached it first
+    return false;
+
+  while(s.probation_bytes + s.protected_bytes + size > shard_capacity){ //evict until it fits, probation first
+    auto &victims = s.probation.size() ? s.probation : s.protected_items;
+    remove_node(s, s.items.find(*victims.back()));
+  }
+
+  int watch = -1;
+  {
+    //every path to the same file gets the same watch, so it's added and recorded at once, otherwise another path's eviction could remove it in between
+    std::lock_guard<std::mutex> watch_guard(watch_lock);
+    watch = inotify_add_watch(inotify_fd, filepath.c_str(), IN_MODIFY | IN_DELETE_SELF | IN_MOVE_SELF);
+    if(watch == -1) //if it can't be watched then it can't be kept up to date, so it isn't cached
+      return false;
+    watch_to_filepaths[watch].insert(filepath);
+  }
+
+  auto node_it = s.items.emplace(filepath, cache_node()).first;
+  auto &node = node_it->second;
+  node.entry = entry;
+  node.watch = watch;
+  s.probation.push_front(&node_it->first); //keys in an unordered_map don't move, even when it rehashes
+  node.position = s.probation.begin();
+  s.probation_bytes += size;
+
+  return true;
+}
+
+void cache::compress_item(const std::string &filepath, const cache_entry_ptr &entry, make_compressed_entry make_entry){
+  {
+    std::lock_guard<std::mutex> guard(compress_lock);
+    if(!compress_thread.joinable()) //only started once something needs compressing
+      compress_thread = std::thread(&cache::compress_worker, this);
+
+    compress_job job{};
+    job.filepath = filepath;
+    job.entry = entry;
+    job.make_entry = std::move(make_entry);
+    compress_jobs.push(std::move(job));
+  }
+  compress_cv.notify_one();
+}
+
+namespace {
+  bool gzip(const file_body &data, std::vector<char> &compressed){
+    z_stream stream{};
+    if(deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) //15 + 16 means a gzip header and trailer
+      return false;
+
+    compressed.resize(deflateBound(&stream, data.size()));
+    stream.next_in = (Bytef*)data.data();
+    stream.avail_in = data.size();
+    stream.next_out = (Bytef*)compressed.data();
+    stream.avail_out = compressed.size();
+
+    const bool finished = deflate(&stream, Z_FINISH) == Z_STREAM_END; //deflateBound is enough room for it to be done in one go
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+    return finished;
+  }
+}
+
+void cache::compress_worker(){
+  while(true){
+    compress_job job{};
+    {
+      std::unique_lock<std::mutex> guard(compress_lock);
+      compress_cv.wait(guard, [this]{ return stop_compressing || compress_jobs.size(); });
+      if(stop_compressing)
+        return;
+      job = std::move(compress_jobs.front());
+      compress_jobs.pop();
+    }
+
+    const auto &data = job.entry->body;
+    std::vector<char> compressed{};
+    if(!gzip(data, compressed) || compressed.size() > data.size() / 100 * MAX_COMPRESSED_PERCENT)
+      continue;
+
+    insert_compressed(job.filepath, job.entry, job.make_entry(file_body(std::move(compressed)), job.entry->info));
+  }
+}
+
+void cache::insert_compressed(const std::string &filepath, const cache_entry_ptr &entry, const cache_entry_ptr &compressed){
+  auto &s = get_shard(filepath);
+  std::lock_guard<std::mutex> guard(s.lock);
+
+  auto node_it = s.items.find(filepath);
+  if(node_it == s.items.end() || node_it->second.entry != entry || node_it->second.compressed) //it's changed or gone since it was queued
+    return;
+
+  auto &node = node_it->second;
+  const auto size = compressed->size();
+  if(node.size() + size > shard_capacity)
+    return;
+
+  auto least_recent_other = [&](std::list<const std::string*> &segment) -> const std::string* { //so that the entry itself isn't evicted
+    for(auto it = segment.rbegin(); it != segment.rend(); it++)
+      if(*it != &node_it->first)
+        return *it;
+    return nullptr;
+  };
+  while(s.probation_bytes + s.protected_bytes + size > shard_capacity){
+    const std::string *victim = least_recent_other(s.probation);
+    if(!victim)
+      victim = least_recent_other(s.protected_items);
+    remove_node(s, s.items.find(*victim)); //there's always one, since this entry and the copy fit on their own
+  }
+
+  node.compressed = compressed;
+  if(node.is_protected)
+    s.protected_bytes += size;
+  else
+    s.probation_bytes += size;
+}
+
+void cache::inotify_event_handler(const char *events, size_t length){
+  size_t offset = 0;
+  while(offset + sizeof(inotify_event) <= length){
+    const auto *event = reinterpret_cast<const inotify_event*>(events + offset);
+    offset += sizeof(inotify_event) + event->len;
+
+    std::vector<std::string> filepaths{}; //every cached path to the file
+    {
+      std::lock_guard<std::mutex> watch_guard(watch_lock);
+      auto watch_it = watch_to_filepaths.find(event->wd);
+      if(watch_it == watch_to_filepaths.end()) //i.e the IN_IGNORED event after a watch is removed
+        continue;
+      filepaths.assign(watch_it->second.begin(), watch_it->second.end());
+    }
+
+    for(const auto &filepath : filepaths){
+      auto &s = get_shard(filepath);
+      std::lock_guard<std::mutex> guard(s.lock);
+      auto node_it = s.items.find(filepath);
+      if(node_it != s.items.end() && node_it->second.watch == event->wd)
+        remove_node(s, node_it); //the next request for it reads the new version
+    }
+  }
+}
@@ -1,12 +1,85 @@
 #include "../header/web_server/web_server.h"
 #include <thread>
+#include <pthread.h>
+#include <sched.h>
 
 #include <sys/timerfd.h>
 
 std::unordered_map<std::string, std::string> central_web_server::config_data_map{};
 
+std::vector<int> central_web_server::get_cpu_list(const std::string &key){
+  std::vector<int> cpus{};
+  if(!config_data_map.count(key))
+    return cpus;
+
+  std::string list = config_data_map[key];
+  char *saveptr = nullptr;
+  for(char *cpu = strtok_r(&list[0], ",", &saveptr); cpu; cpu = strtok_r(nullptr, ",", &saveptr))
+    cpus.push_back(std::stoi(cpu));
+  return cpus;
+}
+
+void central_web_server::pin_server_thread(int thread_idx){
+  const auto cpus = get_cpu_list("SERVER_THREAD_CPUS");
+  if(cpus.empty())
+    return;
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpus[thread_idx % cpus.size()], &cpu_set); //if there are more threads than CPUs, they wrap around
+  if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0)
+    std::cerr << "Couldn't pin server thread " << thread_idx << " to CPU " << cpus[thread_idx % cpus.size()] << std::endl;
+}
+
+tcp_tls_server::server_settings central_web_server::get_server_settings(int thread_idx){
+  tcp_tls_server::server_settings settings{};
+  if(config_data_map.count("CQE_BATCH_WAIT"))
+    settings.cqe_wait_nr = std::stoi(config_data_map["CQE_BATCH_WAIT"]);
+  if(config_data_map.count("CQE_BATCH_TIMEOUT_US"))
+    settings.cqe_wait_timeout_us = std::stoi(config_data_map["CQE_BATCH_TIMEOUT_US"]);
+  if(config_data_map.count("BACKLOG"))
+    settings.backlog = std::stoi(config_data_map["BACKLOG"]);
+  settings.multishot_accept = config_data_map.count("MULTISHOT_ACCEPT") && config_data_map["MULTISHOT_ACCEPT"] == "yes";
+  settings.multishot_recv = config_data_map.count("MULTISHOT_RECV") && config_data_map["MULTISHOT_RECV"] == "yes";
+  if(config_data_map.count("RECV_BUFFERS"))
+    settings.recv_buffer_count = std::stoi(config_data_map["RECV_BUFFERS"]);
+  if(config_data_map.count("ZERO_COPY_THRESHOLD"))
+    settings.zero_copy_threshold = std::stoull(config_data_map["ZERO_COPY_THRESHOLD"]);
+  if(config_data_map.count("FIXED_FILES"))
+    settings.fixed_files = std::stoul(config_data_map["FIXED_FILES"]);
+
+  settings.ktls = config_data_map.count("KTLS") && config_data_map["KTLS"] == "yes";
+  settings.session_tickets = config_data_map.count("SESSION_TICKETS") && config_data_map["SESSION_TICKETS"] == "yes";
+  if(settings.session_tickets && config_data_map.count("MAX_EARLY_DATA"))
+    settings.max_early_data = std::stoul(config_data_map["MAX_EARLY_DATA"]);
+
+  settings.sqpoll = config_data_map.count("SQPOLL") && config_data_map["SQPOLL"] == "yes";
+  if(config_data_map.count("SQPOLL_IDLE_MS"))
+    settings.sq_thread_idle_ms = std::stoul(config_data_map["SQPOLL_IDLE_MS"]);
+  const auto sqpoll_cpus = get_cpu_list("SQPOLL_CPUS");
+  if(sqpoll_cpus.size())
+    settings.sq_thread_cpu = sqpoll_cpus[thread_idx % sqpoll_cpus.size()];
+  settings.single_issuer = config_data_map.count("SINGLE_ISSUER") && config_data_map["SINGLE_ISSUER"] == "yes";
+  if(config_data_map.count("TASKRUN") && config_data_map["TASKRUN"] == "coop")
+    settings.taskrun = tcp_tls_server::task_run::COOP;
+  else if(config_data_map.count("TASKRUN") && config_data_map["TASKRUN"] == "defer")
+    settings.taskrun = tcp_tls_server::task_run::DEFER;
+  return settings;
+}
+
+web_server::web_server_settings central_web_server::get_web_server_settings(){
+  web_server::web_server_settings settings{};
+  if(config_data_map.count("KEEP_ALIVE_TIMEOUT"))
+    settings.keep_alive_timeout = std::stoi(config_data_map["KEEP_ALIVE_TIMEOUT"]);
+  if(config_data_map.count("KEEP_ALIVE_MAX_REQUESTS"))
+    settings.keep_alive_max_requests = std::stoi(config_data_map["KEEP_ALIVE_MAX_REQUESTS"]);
+  return settings;
+}
+
 template<>
-void central_web_server::thread_server_runner(web_server::tls_web_server &basic_web_server){
+void central_web_server::thread_server_runner(web_server::tls_web_server &basic_web_server, int thread_idx){
+  pin_server_thread(thread_idx); //before the server is made, so its memory is allocated near the CPU it's pinned to
+
   web_server::tls_server tcp_server(
     std::stoi(config_data_map["TLS_PORT"]),
     config_data_map["FULLCHAIN"],
@@ -17,16 +90,23 @@ void central_web_server::thread_server_runner(web_server::tls_web_server &basic_
     tcp_callbacks::read_cb<server_type::TLS>,
     tcp_callbacks::write_cb<server_type::TLS>,
     tcp_callbacks::event_cb<server_type::TLS>,
-    tcp_callbacks::custom_read_cb<server_type::TLS>
+    tcp_callbacks::custom_read_cb<server_type::TLS>,
+    get_server_settings(thread_idx)
   ); //pass function pointers and a custom object
 
+  basic_web_server.settings = get_web_server_settings();
+  basic_web_server.web_cache = &instance().file_cache;
+  basic_web_server.broadcasts = &instance().broadcasts;
   basic_web_server.set_tcp_server(&tcp_server); //required to be called, to give it a pointer to the server
 
   tcp_server.start();
+  basic_web_server.stop_receiving_broadcasts(); //tcp_server is about to go, and the central thread could still be publishing
 }
 
 template<>
-void central_web_server::thread_server_runner(web_server::plain_web_server &basic_web_server){
+void central_web_server::thread_server_runner(web_server::plain_web_server &basic_web_server, int thread_idx){
+  pin_server_thread(thread_idx); //before the server is made, so its memory is allocated near the CPU it's pinned to
+
   web_server::plain_server tcp_server(
     std::stoi(config_data_map["PORT"]),
     &basic_web_server,
@@ -35,12 +115,17 @@ void central_web_server::thread_server_runner(web_server::plain_web_server &basi
     tcp_callbacks::read_cb<server_type::NON_TLS>,
     tcp_callbacks::write_cb<server_type::NON_TLS>,
     tcp_callbacks::event_cb<server_type::NON_TLS>,
-    tcp_callbacks::custom_read_cb<server_type::NON_TLS>
+    tcp_callbacks::custom_read_cb<server_type::NON_TLS>,
+    get_server_settings(thread_idx)
   ); //pass function pointers and a custom object
   
+  basic_web_server.settings = get_web_server_settings();
+  basic_web_server.web_cache = &instance().file_cache;
+  basic_web_server.broadcasts = &instance().broadcasts;
   basic_web_server.set_tcp_server(&tcp_server); //required to be called, to give it a pointer to the server
   
   tcp_server.start();
+  basic_web_server.stop_receiving_broadcasts(); //tcp_server is about to go, and the central thread could still be publishing
 }
 
 void central_web_server::start_server(const char *config_file_path){
@@ -94,86 +179,106 @@ void central_web_server::start_server(const char *config_file_path){
   // the below is more like demo code to test out the multithreaded features
 
   //done reading config
+  if(config_data_map.count("CACHE_SIZE")) // in MiB
+    file_cache.set_capacity(std::stoull(config_data_map["CACHE_SIZE"]) << 20);
+  if(config_data_map.count("CACHE_MMAP") && config_data_map["CACHE_MMAP"] == "yes")
+    file_cache.set_backend(web_cache::cache_backend::MMAP);
+
   const auto num_threads = config_data_map.count("SERVER_THREADS") ? std::stoi(config_data_map["SERVER_THREADS"]) : 3; //by default uses 3 threads
 
   std::cout << "Running server\n";
 
   if(config_data_map["TLS"] == "yes"){
     std::cout << "TLS will be used\n";
+    certificate_watcher.start(config_data_map["FULLCHAIN"], config_data_map["PKEY"]); // before the server threads start, so none of them get SIGHUP
     run<server_type::TLS>(num_threads);
   }else{
     run<server_type::NON_TLS>(num_threads);
   }
 }
 
+io_uring_sqe *central_web_server::get_sqe(){
+  io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+  if(sqe == nullptr){ // the submission queue is full, so flush what has been queued so far and try again
+    io_uring_submit(&ring);
+    sqe = io_uring_get_sqe(&ring);
+  }
+  return sqe;
+}
+
 void central_web_server::add_event_read_req(int event_fd, central_web_server_event event, uint64_t custom_info){
-  io_uring_sqe *sqe = io_uring_get_sqe(&ring); //get a valid SQE (correct index and all)
-  auto *req = new central_web_server_req(); //enough space for the request struct
+  io_uring_sqe *sqe = get_sqe(); //get a valid SQE (correct index and all)
+  auto *req = requests.acquire();
   req->buff.resize(sizeof(uint64_t));
   req->event = event;
   req->fd = event_fd;
   req->custom_info = custom_info;
   
   io_uring_prep_read(sqe, event_fd, &(req->buff[0]), sizeof(uint64_t), 0); //don't read at an offset
-  io_uring_sqe_set_data(sqe, req);
-  io_uring_submit(&ring);
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
 }
 
 void central_web_server::add_read_req(int fd, size_t size){
-  io_uring_sqe *sqe = io_uring_get_sqe(&ring); //get a valid SQE (correct index and all)
-  auto *req = new central_web_server_req(); //enough space for the request struct
+  io_uring_sqe *sqe = get_sqe(); //get a valid SQE (correct index and all)
+  auto *req = requests.acquire();
   req->buff.resize(size);
   req->event = central_web_server_event::READ;
   req->fd = fd;
   
   io_uring_prep_read(sqe, fd, &(req->buff[0]), size, 0); //don't read at an offset
-  io_uring_sqe_set_data(sqe, req);
-  io_uring_submit(&ring); //submits the event
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
 }
 
 void central_web_server::add_timer_read_req(int timer_fd){
-  io_uring_sqe *sqe = io_uring_get_sqe(&ring); //get a valid SQE (correct index and all)
-  auto *req = new central_web_server_req(); //enough space for the request struct
+  io_uring_sqe *sqe = get_sqe(); //get a valid SQE (correct index and all)
+  auto *req = requests.acquire();
   req->buff.resize(sizeof(uint64_t));
   req->event = central_web_server_event::TIMERFD;
   req->fd = timer_fd;
   
   io_uring_prep_read(sqe, timer_fd, &(req->buff[0]), sizeof(uint64_t), 0); //don't read at an offset
-  io_uring_sqe_set_data(sqe, req);
-  io_uring_submit(&ring);
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
+}
+
+void central_web_server::add_inotify_read_req(){
+  io_uring_sqe *sqe = get_sqe(); //get a valid SQE (correct index and all)
+  auto *req = requests.acquire();
+  req->buff.resize(web_cache::INOTIFY_READ_SIZE);
+  req->event = central_web_server_event::INOTIFY;
+  req->fd = file_cache.inotify_fd;
+  
+  io_uring_prep_read(sqe, req->fd, &(req->buff[0]), req->buff.size(), 0); //don't read at an offset
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
 }
 
 void central_web_server::add_write_req(int fd, const char *buff_ptr, size_t size){
-  auto *req = new central_web_server_req();
+  auto *req = requests.acquire();
   req->buff_ptr = buff_ptr;
   req->size = size;
   req->fd = fd;
   req->event = central_web_server_event::WRITE;
 
-  io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+  io_uring_sqe *sqe = get_sqe();
   io_uring_prep_write(sqe, fd, buff_ptr, size, 0); //do not write at an offset
-  io_uring_sqe_set_data(sqe, req);
-  io_uring_submit(&ring); //submits the event
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
 }
 
 void central_web_server::read_req_continued(central_web_server_req *req, size_t last_read){
   req->progress_bytes += last_read;
   
-  io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+  io_uring_sqe *sqe = get_sqe();
   //the fd is stored in the custom info bit
   io_uring_prep_read(sqe, (int)req->fd, &(req->buff[req->progress_bytes]), req->buff.size() - req->progress_bytes, req->progress_bytes);
-  io_uring_sqe_set_data(sqe, req);
-  io_uring_submit(&ring); //submits the event
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
 }
 
 void central_web_server::write_req_continued(central_web_server_req *req, size_t written){
   req->progress_bytes += written;
   
-  io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+  io_uring_sqe *sqe = get_sqe();
   // again, buff_ptr is used for writing, progress_bytes is how much has been written/read (written in this case)
   io_uring_prep_write(sqe, req->fd, &req->buff_ptr[req->progress_bytes], req->size - req->progress_bytes, 0); //do not write at an offset
-  io_uring_sqe_set_data(sqe, req);
-  io_uring_submit(&ring); //submits the event
+  io_uring_sqe_set_data64(sqe, req->pool_idx);
 }
 
 template<server_type T>
@@ -185,21 +290,21 @@ void central_web_server::run(int num_threads){
   std::memset(&ring, 0, sizeof(io_uring));
   io_uring_queue_init(QUEUE_DEPTH, &ring, 0); //no flags, setup the queue
 
-  io_uring_cqe *cqe;
+  io_uring_cqe *cqes[tcp_tls_server::CQE_BATCH_SIZE];
 
   const auto make_ws_frame = config_data_map["TLS"] == "yes" ? web_server::basic_web_server<server_type::TLS>::make_ws_frame : web_server::basic_web_server<server_type::NON_TLS>::make_ws_frame;
 
-  std::vector<server_data<T>> thread_data_container{};
-  thread_data_container.resize(num_threads);
+  broadcasts.set_max_consumers(num_threads); // before the threads start, since each one adds itself as a consumer
 
-  int idx = 0;
-  for(auto &thread_data : thread_data_container){
-    // custom info is the idx of the server in the vector
-    add_event_read_req(thread_data.server.central_communication_eventfd, central_web_server_event::SERVER_THREAD_COMMUNICATION, idx++); // add read for all thread events
-  }
+  std::deque<server_data<T>> thread_data_container{}; // a deque, since each thread has a reference to its server, so they're never moved
+  for(int i = 0; i < num_threads; i++)
+    thread_data_container.emplace_back(i);
 
   // need to read on the kill efd
   add_event_read_req(kill_server_efd, central_web_server_event::KILL_SERVER);
+
+  // the file cache's inotify events, so changed files are removed from it
+  add_inotify_read_req();
   
   bool run_server = true;
 
@@ -218,77 +323,77 @@ void central_web_server::run(int num_threads){
   add_timer_read_req(timer_fd);
 
   int x = 0;
+  uint64_t timer_ticks = 0;
 
   while(run_server){
-    char ret = io_uring_wait_cqe(&ring, &cqe);
+    // submits everything queued while handling the last batch, and waits for the next completion
+    int ret = io_uring_submit_and_wait(&ring, 1);
 
-    if(ret < 0){
-      io_uring_queue_exit(&ring);
-      close(event_fd);
+    if(ret < 0 && ret != -EINTR)
       break;
-    }
 
-    auto *req = reinterpret_cast<central_web_server_req*>(cqe->user_data);
-
-    if(cqe->res < 0){
-      std::cerr << "CQE RES CENTRAL: " << cqe->res << std::endl;
-      std::cerr << "ERRNO: " << errno << std::endl;
-      std::cerr << "io_uring_wait_cqe ret: " << int(ret) << std::endl;
-      io_uring_cqe_seen(&ring, cqe); //mark this CQE as seen
-      continue;
-    }
-
-    switch (req->event) {
-      case central_web_server_event::KILL_SERVER: {
-        io_uring_queue_exit(&ring);
-        close(event_fd);
-        run_server = false;
-        break;
+    // reap every completion which is ready, and only advance the completion queue once they've all been dealt with
+    const unsigned cqe_count = io_uring_peek_batch_cqe(&ring, cqes, tcp_tls_server::CQE_BATCH_SIZE);
+    for(unsigned i = 0; i < cqe_count; i++){
+      io_uring_cqe *cqe = cqes[i];
+      auto *req = requests.get(cqe->user_data);
+
+      if(cqe->res < 0){
+        std::cerr << "CQE RES CENTRAL: " << cqe->res << std::endl;
+        std::cerr << "ERRNO: " << errno << std::endl;
+        std::cerr << "io_uring_submit_and_wait ret: " << int(ret) << std::endl;
+        requests.release(req);
+        continue;
       }
-      case central_web_server_event::TIMERFD: {
-        auto ws_data = make_ws_frame("haha", web_server::websocket_non_control_opcodes::text_frame);
-
-        auto item_data = store.insert_item(std::move(ws_data), num_threads);
-
-        // you need to add something to deal with when a write request for broadcast is cancelled
-        // and then notify the central server that we don't need the buffer anymore
 
-        for(auto &thread_data : thread_data_container)
-          thread_data.server.post_message_to_server_thread(web_server::message_type::websocket_broadcast, reinterpret_cast<const char*>(item_data.buffer.ptr), item_data.buffer.size, item_data.idx);
+      switch (req->event) {
+        case central_web_server_event::KILL_SERVER: {
+          run_server = false; // the ring is torn down once the rest of this batch has been dealt with
+          break;
+        }
+        case central_web_server_event::TIMERFD: {
+          // every thread shares the one frame, and it's freed by whichever thread finishes writing it last
+          const auto ws_data = make_ws_frame("haha", web_server::websocket_non_control_opcodes::text_frame);
+          broadcasts.publish(web_server::broadcast_frame(ws_data.data(), ws_data.size()));
 
-        add_timer_read_req(timer_fd); // rearm the timer
-        break;
-      }
-      case central_web_server_event::SERVER_THREAD_COMMUNICATION: {
-        if(req->custom_info != -1){ // then the idx is set as custom_info
-          auto data = thread_data_container[req->custom_info].server.get_from_to_program_queue();
-          store.free_item(data.item_idx);
+          if(T == server_type::TLS && ++timer_ticks % SESSION_STATS_INTERVAL == 0)
+            print_session_stats();
 
-          add_event_read_req(req->fd, central_web_server_event::SERVER_THREAD_COMMUNICATION, req->custom_info); // rearm the eventfd
+          add_timer_read_req(timer_fd); // rearm the timer
+          break;
         }
-        break;
-      }
-      case central_web_server_event::READ:
-        if(req->buff.size() == cqe->res + req->progress_bytes){
-          // the entire thing has been read, add it to some local cache or something
-        }else{
-          read_req_continued(req, cqe->res);
-          req = nullptr;
+        case central_web_server_event::INOTIFY: {
+          file_cache.inotify_event_handler(&req->buff[0], cqe->res);
+          add_inotify_read_req();
+          break;
         }
-        break;
-      case central_web_server_event::WRITE:
-        if(cqe->res + req->progress_bytes < req->size){ // if there is still more to write, then write
-          write_req_continued(req, cqe->res);
-        }else{
-          // we're finished writing otherwise
-        }
-        break;
+        case central_web_server_event::READ:
+          if(req->buff.size() == cqe->res + req->progress_bytes){
+            // the entire thing has been read, add it to some local cache or something
+          }else{
+            read_req_continued(req, cqe->res);
+            req = nullptr;
+          }
+          break;
+        case central_web_server_event::WRITE:
+          if(cqe->res + req->progress_bytes < req->size){ // if there is still more to write, then write
+            write_req_continued(req, cqe->res);
+            req = nullptr;
+          }else{
+            // we're finished writing otherwise
+          }
+          break;
+      }
+
+      if(req != nullptr)
+        requests.release(req);
     }
 
-    delete req;
-    
-    io_uring_cqe_seen(&ring, cqe); //mark this CQE as seen
+    io_uring_cq_advance(&ring, cqe_count); // mark the whole batch as seen
   }
+
+  io_uring_queue_exit(&ring);
+  close(event_fd);
   
   close(timer_fd);
 
@@ -297,6 +402,18 @@ void central_web_server::run(int num_threads){
     thread_data.thread.join();
 }
 
+void central_web_server::print_session_stats(){
+  const auto &stats = tcp_tls_server::server<server_type::TLS>::get_session_stats();
+  const uint64_t full = stats.full_handshakes.load(std::memory_order_relaxed);
+  const uint64_t resumed = stats.resumed_handshakes.load(std::memory_order_relaxed);
+  const uint64_t early_data = stats.early_data_handshakes.load(std::memory_order_relaxed);
+  if(full + resumed == last_printed_handshakes)
+    return;
+  last_printed_handshakes = full + resumed;
+
+  std::cout << "TLS handshakes: " << full << " full, " << resumed << " resumed (" << (resumed * 100 / (full + resumed)) << "%), " << early_data << " with early data" << std::endl;
+}
+
 void central_web_server::kill_server(){
   auto kill_sig = central_web_server_event::KILL_SERVER;
   write(event_fd, &kill_sig, sizeof(kill_sig));
@@ -0,0 +1,83 @@
+#include "../header/web_server/certificate_watcher.h"
+#include "../header/server.h"
+
+#include <csignal>
+#include <climits>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+
+using namespace web_server;
+
+void certificate_watcher::watch_directory(const std::string &path){
+  const auto slash = path.rfind('/');
+  const std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+  file_names.push_back(slash == std::string::npos ? path : path.substr(slash + 1));
+  //new files and links are made then renamed over the old ones, or the files are written in place
+  if(inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) == -1)
+    std::cerr << "Can't watch " << directory << " for new certificates, send SIGHUP to reload them" << std::endl;
+}
+
+void certificate_watcher::start(const std::string &fullchain_path, const std::string &pkey_path){
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+
+  inotify_fd = inotify_init1(IN_CLOEXEC);
+  watch_directory(fullchain_path);
+  watch_directory(pkey_path);
+
+  stop_efd = eventfd(0, EFD_CLOEXEC);
+  watch_thread = std::thread(&certificate_watcher::watch, this);
+}
+
+void certificate_watcher::watch(){
+  alignas(inotify_event) char events[sizeof(inotify_event) + NAME_MAX + 1];
+  pollfd fds[] = { { stop_efd, POLLIN, 0 }, { signal_fd, POLLIN, 0 }, { inotify_fd, POLLIN, 0 } };
+
+  while(true){
+    if(poll(fds, 3, -1) <= 0)
+      continue; //i.e EINTR
+    if(fds[0].revents)
+      return;
+
+    bool reload = false;
+    if(fds[1].revents){
+      signalfd_siginfo info;
+      reload = read(signal_fd, &info, sizeof(info)) == sizeof(info);
+    }
+    if(fds[2].revents){ //only changes to the certificate files count, not everything else in their directories
+      const auto length = read(inotify_fd, events, sizeof(events));
+      for(ssize_t offset = 0; offset + (ssize_t)sizeof(inotify_event) <= length;){
+        const auto *event = reinterpret_cast<const inotify_event*>(events + offset);
+        offset += sizeof(inotify_event) + event->len;
+        for(const auto &name : file_names)
+          reload |= event->len && name == event->name;
+      }
+    }
+    if(!reload)
+      continue;
+
+    //both files are usually replaced, so anything else which happens meanwhile is part of the same change
+    while(poll(&fds[2], 1, CERTIFICATE_SETTLE_MS) > 0)
+      read(inotify_fd, events, sizeof(events));
+
+    if(tcp_tls_server::server<server_type::TLS>::reload_certificates())
+      std::cout << "Reloaded the TLS certificates" << std::endl;
+  }
+}
+
+certificate_watcher::~certificate_watcher(){
+  if(watch_thread.joinable()){
+    const uint64_t stop = 1;
+    write(stop_efd, &stop, sizeof(stop));
+    watch_thread.join();
+  }
+  for(const int fd : { inotify_fd, signal_fd, stop_efd })
+    if(fd != -1) close(fd);
+}
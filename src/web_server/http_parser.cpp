@@ -0,0 +1,154 @@
+#include "../header/web_server/http_parser.h"
+
+#if defined(__AVX2__) || defined(__SSE4_2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace web_server;
+
+const char *web_server::find_first_of(const char *begin, const char *end, char a, char b){
+#if defined(__AVX2__)
+  //32 bytes at a time
+  const __m256i a_vec = _mm256_set1_epi8(a);
+  const __m256i b_vec = _mm256_set1_epi8(b);
+  for(; end - begin >= 32; begin += 32){
+    const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    const uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, a_vec), _mm256_cmpeq_epi8(chunk, b_vec)));
+    if(mask)
+      return begin + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE4_2__)
+  //16 bytes at a time, compared against the set of both characters in one instruction
+  const __m128i needles = _mm_setr_epi8(a, b, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  for(; end - begin >= 16; begin += 16){
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    const int idx = _mm_cmpestri(needles, 2, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+    if(idx != 16)
+      return begin + idx;
+  }
+#elif defined(__SSE2__)
+  //16 bytes at a time, always available on x86-64
+  const __m128i a_vec = _mm_set1_epi8(a);
+  const __m128i b_vec = _mm_set1_epi8(b);
+  for(; end - begin >= 16; begin += 16){
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    const uint32_t mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, a_vec), _mm_cmpeq_epi8(chunk, b_vec)));
+    if(mask)
+      return begin + __builtin_ctz(mask);
+  }
+#endif
+  for(; begin != end; begin++) //whatever is left (or everything, without SIMD)
+    if(*begin == a || *begin == b)
+      return begin;
+  return end;
+}
+
+bool string_span::next_list_item(size_t &position, string_span &item) const {
+  const char *pos = data + position;
+  const char *end = data + length;
+  while(pos < end && (*pos == ' ' || *pos == '\t' || *pos == ',')) //skip to the start of the next item
+    pos++;
+  if(pos == end)
+    return false;
+
+  const char *item_end = find_first_of(pos, end, ',', ',');
+  const char *trimmed_end = item_end;
+  while(trimmed_end > pos && (trimmed_end[-1] == ' ' || trimmed_end[-1] == '\t'))
+    trimmed_end--;
+
+  item = string_span(pos, trimmed_end - pos);
+  position = item_end - data;
+  return true;
+}
+
+bool string_span::has_token(const char *token) const {
+  size_t position = 0;
+  string_span item{};
+  while(next_list_item(position, item))
+    if(item.equals_case_insensitive(token))
+      return true;
+  return false;
+}
+
+http_parse_result http_parser::parse(const char *data, size_t length){
+  base = data;
+  const char *end = data + length;
+
+  while(state == parse_state::REQUEST_LINE || state == parse_state::HEADERS){
+    const char *line = data + line_start;
+
+    //a header line's colon and line feed are found in one pass
+    const char *colon = nullptr;
+    const char *lf = find_first_of(line, end, ':', '\n');
+    if(lf != end && *lf == ':'){
+      colon = lf;
+      lf = find_first_of(colon, end, '\n', '\n');
+    }
+    if(lf == end) //the rest of this line hasn't been received yet, so carry on from the start of it next time
+      return http_parse_result::INCOMPLETE;
+
+    const char *line_end = lf > line && lf[-1] == '\r' ? lf - 1 : lf; //CRLF, but a bare LF is accepted too
+    line_start = lf + 1 - data;
+
+    if(state == parse_state::REQUEST_LINE){
+      if(line_end == line) //empty lines before the request line are ignored
+        continue;
+      state = parse_request_line(line, line_end) ? parse_state::HEADERS : parse_state::ERROR;
+    }else if(line_end == line){ //the blank line after the headers
+      request_end = line_start;
+      state = parse_state::COMPLETE;
+    }else if(colon == nullptr || !parse_header_line(line, line_end, colon)){
+      state = parse_state::ERROR;
+    }
+  }
+
+  return state == parse_state::COMPLETE ? http_parse_result::COMPLETE : http_parse_result::ERROR;
+}
+
+bool http_parser::parse_request_line(const char *line, const char *line_end){ //i.e GET /index.html HTTP/1.1
+  const char *method_end = find_first_of(line, line_end, ' ', ' ');
+  if(method_end == line || method_end == line_end)
+    return false;
+
+  const char *target = method_end + 1;
+  const char *target_end = find_first_of(target, line_end, ' ', ' ');
+  if(target_end == target || target_end == line_end)
+    return false;
+
+  const char *version = target_end + 1;
+  if(line_end - version < 5 || std::memcmp(version, "HTTP/", 5) != 0)
+    return false;
+
+  method_field = { (uint32_t)(line - base), (uint32_t)(method_end - line) };
+  target_field = { (uint32_t)(target - base), (uint32_t)(target_end - target) };
+  version_field = { (uint32_t)(version - base), (uint32_t)(line_end - version) };
+  return true;
+}
+
+bool http_parser::parse_header_line(const char *line, const char *line_end, const char *colon){ //i.e Range: bytes=0-499
+  if(colon == line || num_headers == MAX_HTTP_HEADERS)
+    return false;
+  for(const char *c = line; c != colon; c++) //no whitespace is allowed in the name
+    if(*c == ' ' || *c == '\t')
+      return false;
+
+  const char *value = colon + 1;
+  const char *value_end = line_end;
+  while(value < value_end && (*value == ' ' || *value == '\t'))
+    value++;
+  while(value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+    value_end--;
+
+  header_names[num_headers] = { (uint32_t)(line - base), (uint32_t)(colon - line) };
+  header_values[num_headers] = { (uint32_t)(value - base), (uint32_t)(value_end - value) };
+  num_headers++;
+  return true;
+}
+
+string_span http_parser::header(const char *name) const {
+  for(int i = 0; i < num_headers; i++)
+    if(header_name(i).equals_case_insensitive(name))
+      return header_value(i);
+  return {};
+}
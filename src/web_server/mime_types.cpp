@@ -0,0 +1,51 @@
+#include "../header/web_server/mime_types.h"
+
+#include <strings.h>
+#include <cstring>
+
+namespace {
+  constexpr const char *DEFAULT_CONTENT_TYPE = "Content-Type: application/octet-stream\r\n";
+
+  //a hash can match something which isn't the extension, so it's checked as well
+  const char *if_extension(const char *extension, size_t length, const char *expected, size_t expected_length, const char *content_type){
+    return length == expected_length && strncasecmp(extension, expected, length) == 0 ? content_type : DEFAULT_CONTENT_TYPE;
+  }
+
+  template<size_t N>
+  const char *if_extension(const char *extension, size_t length, const char (&expected)[N], const char *content_type){
+    return if_extension(extension, length, expected, N - 1, content_type);
+  }
+}
+
+const char *web_server::get_content_type(const char *filepath, size_t length){
+  const char *extension = filepath + length;
+  while(extension != filepath && *(extension - 1) != '.'){
+    if(*(extension - 1) == '/') //the last part of the path has no extension
+      return DEFAULT_CONTENT_TYPE;
+    extension--;
+  }
+  if(extension == filepath)
+    return DEFAULT_CONTENT_TYPE;
+
+  const size_t extension_length = filepath + length - extension;
+  switch(mime_hash(extension, extension_length)){
+    case mime_hash("html"): return if_extension(extension, extension_length, "html", "Content-Type: text/html\r\n");
+    case mime_hash("htm"): return if_extension(extension, extension_length, "htm", "Content-Type: text/html\r\n");
+    case mime_hash("css"): return if_extension(extension, extension_length, "css", "Content-Type: text/css\r\n");
+    case mime_hash("js"): return if_extension(extension, extension_length, "js", "Content-Type: text/javascript\r\n");
+    case mime_hash("opus"): return if_extension(extension, extension_length, "opus", "Content-Type: audio/opus\r\n");
+    case mime_hash("mp3"): return if_extension(extension, extension_length, "mp3", "Content-Type: audio/mpeg\r\n");
+    case mime_hash("mp4"): return if_extension(extension, extension_length, "mp4", "Content-Type: video/mp4\r\n");
+    case mime_hash("gif"): return if_extension(extension, extension_length, "gif", "Content-Type: image/gif\r\n");
+    case mime_hash("png"): return if_extension(extension, extension_length, "png", "Content-Type: image/png\r\n");
+    case mime_hash("jpg"): return if_extension(extension, extension_length, "jpg", "Content-Type: image/jpeg\r\n");
+    case mime_hash("jpeg"): return if_extension(extension, extension_length, "jpeg", "Content-Type: image/jpeg\r\n");
+    case mime_hash("txt"): return if_extension(extension, extension_length, "txt", "Content-Type: text/plain\r\n");
+    case mime_hash("wasm"): return if_extension(extension, extension_length, "wasm", "Content-Type: application/wasm\r\n");
+    default: return DEFAULT_CONTENT_TYPE;
+  }
+}
+
+bool web_server::is_compressible(const char *content_type){
+  return std::strncmp(content_type, "Content-Type: text/", 19) == 0 || std::strcmp(content_type, "Content-Type: application/wasm\r\n") == 0;
+}
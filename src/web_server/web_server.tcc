@@ -4,7 +4,7 @@
 using namespace web_server;
 
 template<server_type T>
-bool basic_web_server<T>::get_process(std::string &path, bool accept_bytes, const std::string& sec_websocket_key, int client_idx){
+bool basic_web_server<T>::get_process(std::string &path, const file_request_headers &request_headers, const std::string& sec_websocket_key, int client_idx){
   const auto original_path = path;
 
   char *saveptr = nullptr;
@@ -17,7 +17,7 @@ bool basic_web_server<T>::get_process(std::string &path, bool accept_bytes, cons
   }else{
     path = original_path == "" ? "public/index.html" : "public/"+original_path;
     
-    if(send_file_request(client_idx, path, accept_bytes, 200))
+    if(send_file_request(client_idx, path, request_headers, 200))
       return true;
     return false;
   }
@@ -35,102 +35,501 @@ bool basic_web_server<T>::is_valid_http_req(const char* buff, int length){
 }
 
 template<server_type T>
-std::string basic_web_server<T>::get_content_type(std::string filepath){
-  char *file_extension_data = (char*)filepath.c_str();
-  std::string file_extension = "";
-  char *saveptr = nullptr;
-  while((file_extension_data = strtok_r(file_extension_data, ".", &saveptr))){
-    file_extension = file_extension_data;
-    file_extension_data = nullptr;
-  }
-
-  if(file_extension == "html" || file_extension == "htm")
-    return "Content-Type: text/html\r\n";
-  if(file_extension == "css")
-    return "Content-Type: text/css\r\n";
-  if(file_extension == "js")
-    return "Content-Type: text/javascript\r\n";
-  if(file_extension == "opus")
-    return "Content-Type: audio/opus\r\n";
-  if(file_extension == "mp3")
-    return "Content-Type: audio/mpeg\r\n";
-  if(file_extension == "mp4")
-    return "Content-Type: video/mp4\r\n";
-  if(file_extension == "gif")
-    return "Content-Type: image/gif\r\n";
-  if(file_extension == "png")
-    return "Content-Type: image/png\r\n";
-  if(file_extension == "jpg" || file_extension == "jpeg")
-    return "Content-Type: image/jpeg\r\n";
-  if(file_extension == "txt")
-    return "Content-Type: text/plain\r\n";
-  if(file_extension == "wasm")
-    return "Content-Type: application/wasm\r\n";
-  return "Content-Type: application/octet-stream\r\n";
-}
-
-template<server_type T>
-bool basic_web_server<T>::send_file_request(int client_idx, const std::string &filepath, bool accept_bytes, int response_code){
-  const auto file_fd = open(filepath.c_str(), O_RDONLY);
+byte_range basic_web_server<T>::parse_range(string_span range_header, size_t file_size){
+  byte_range range{};
+  range.length = file_size; //the whole file unless a valid range is found
+
+  const char *pos = range_header.data;
+  const char *end = range_header.data + range_header.length;
+
+  //only single byte ranges are supported, anything else (other units, multiple ranges, or bad syntax) is ignored, so the whole file is sent
+  if(range_header.length < 6 || std::memcmp(pos, "bytes=", 6) != 0 || find_first_of(pos, end, ',', ',') != end)
+    return range;
+  pos += 6;
+
+  const auto parse_number = [&pos, end](size_t &number){ //reads digits from pos, values too big to fit are clamped
+    if(pos == end || !isdigit(*pos)) return false;
+    number = 0;
+    for(; pos != end && isdigit(*pos); pos++){
+      const size_t digit = *pos - '0';
+      number = number > (SIZE_MAX - digit) / 10 ? SIZE_MAX : number * 10 + digit;
+    }
+    return true;
+  };
+
+  if(pos != end && *pos == '-'){ //a suffix range, i.e bytes=-500 is the last 500 bytes
+    pos++;
+    size_t suffix_length{};
+    if(!parse_number(suffix_length) || pos != end) return range;
+
+    range.requested = true;
+    if(suffix_length == 0 || file_size == 0){
+      range.satisfiable = false;
+      return range;
+    }
+    range.length = std::min(suffix_length, file_size);
+    range.start = file_size - range.length;
+    return range;
+  }
+
+  size_t first{};
+  if(!parse_number(first) || pos == end || *pos != '-') return range;
+  pos++;
+
+  size_t last = SIZE_MAX; //if there's no last byte, then it goes to the end of the file
+  if(pos != end && (!parse_number(last) || pos != end || last < first)) return range;
+
+  range.requested = true;
+  if(first >= file_size){
+    range.satisfiable = false;
+    return range;
+  }
+  range.start = first;
+  range.length = std::min(last, file_size - 1) - first + 1;
+  return range;
+}
+
+template<server_type T>
+file_info basic_web_server<T>::get_file_info(int file_fd, const char *content_type, content_encoding encoding){
+  file_info info{};
+  info.content_type = content_type;
+  info.encoding = encoding;
+
+  struct stat file_stat{};
+  if(fstat(file_fd, &file_stat) == -1)
+    return info;
+
+  info.size = S_ISBLK(file_stat.st_mode) ? utility::get_file_size(file_fd) : file_stat.st_size;
+  info.modified_time = file_stat.st_mtim.tv_sec;
+
+  const uint64_t modified_ns = (uint64_t)file_stat.st_mtim.tv_sec * 1000000000 + file_stat.st_mtim.tv_nsec;
+  char etag[64]{};
+  snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx\"", (unsigned long)file_stat.st_ino, (unsigned long)info.size, (unsigned long)modified_ns);
+  info.etag = etag;
+
+  tm modified_time{};
+  gmtime_r(&file_stat.st_mtim.tv_sec, &modified_time);
+  char last_modified[64]{};
+  strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", &modified_time);
+  info.last_modified = last_modified;
+
+  return info;
+}
+
+template<server_type T>
+std::string basic_web_server<T>::make_response_head(int response_code, const byte_range &range, const file_info &info, bool keep_alive, const std::string &keep_alive_header){
+  std::string headers{};
+  headers.reserve(512);
 
-  std::string header_first_line{};
   switch(response_code){
     case 200:
-      header_first_line = "HTTP/1.0 200 OK\r\n";
+      headers += range.requested ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
       break;
     default:
-      header_first_line = "HTTP/1.0 404 Not Found\r\n";
+      headers += "HTTP/1.1 404 Not Found\r\n";
+  }
+
+  headers += info.content_type;
+  if(info.encoding != IDENTITY)
+    headers += std::string("Content-Encoding: ") + ENCODING_NAMES[info.encoding] + "\r\n";
+  headers += keep_alive ? keep_alive_header : "Connection: close\r\n";
+  if(response_code == 200){ //these describe the file at this path, which a 404 page isn't
+    headers += "Accept-Ranges: bytes\r\nETag: " + info.etag + "\r\nLast-Modified: " + info.last_modified + "\r\n";
+    headers += "Vary: Accept-Encoding\r\n"; //since it could be sent compressed differently, depending on what the client accepts
+  }
+  headers += "Content-Length: " + std::to_string(range.length) + "\r\n";
+  if(range.requested)
+    headers += "Content-Range: bytes " + std::to_string(range.start) + "-" + std::to_string(range.start + range.length - 1) + "/" + std::to_string(info.size) + "\r\n";
+  if(response_code == 200) //it can be kept, but it's checked with the ETag each time it's used
+    headers += "Cache-Control: no-cache\r\n";
+  else
+    headers += "Cache-Control: no-cache, no-store, must-revalidate\r\nPragma: no-cache\r\nExpires: 0\r\n";
+
+  headers += "\r\n";
+  return headers;
+}
+
+template<server_type T>
+std::string basic_web_server<T>::make_not_modified_head(const file_info &info, bool keep_alive, const std::string &keep_alive_header){
+  return "HTTP/1.1 304 Not Modified\r\nETag: " + info.etag + "\r\nLast-Modified: " + info.last_modified + "\r\nVary: Accept-Encoding\r\nCache-Control: no-cache\r\n" +
+    (keep_alive ? keep_alive_header : "Connection: close\r\n") + "\r\n";
+}
+
+template<server_type T>
+bool basic_web_server<T>::is_not_modified(const file_request_headers &request_headers, const file_info &info){
+  if(!request_headers.if_none_match.empty()){ //a list of ETags, or *, the weak comparison is used, so W/ prefixes are ignored
+    size_t position = 0;
+    string_span tag{};
+    while(request_headers.if_none_match.next_list_item(position, tag)){
+      if(tag.equals("*"))
+        return true;
+      if(tag.length > 2 && tag.data[0] == 'W' && tag.data[1] == '/')
+        tag = string_span(tag.data + 2, tag.length - 2);
+      if(tag.length == info.etag.size() && std::memcmp(tag.data, info.etag.data(), info.etag.size()) == 0)
+        return true;
+    }
+    return false; //If-Modified-Since is ignored when there's an If-None-Match
+  }
+
+  if(!request_headers.if_modified_since.empty()){
+    char date[64]{};
+    if(request_headers.if_modified_since.length >= sizeof(date))
+      return false;
+    std::memcpy(date, request_headers.if_modified_since.data, request_headers.if_modified_since.length);
+
+    tm since{};
+    if(!strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &since)) //not a date it understands, so the whole file is sent
+      return false;
+    return info.modified_time <= timegm(&since);
+  }
+
+  return false;
+}
+
+template<server_type T>
+int basic_web_server<T>::parse_accept_encoding(string_span accept_encoding){
+  int accepted = 0;
+  size_t position = 0;
+  string_span item{};
+  while(accept_encoding.next_list_item(position, item)){ //i.e "gzip, deflate, br;q=0.9"
+    const char *end = item.data + item.length;
+    const char *params = find_first_of(item.data, end, ';', ';');
+    const char *name_end = params;
+    while(name_end > item.data && (name_end[-1] == ' ' || name_end[-1] == '\t'))
+      name_end--;
+    const string_span name(item.data, name_end - item.data);
+
+    bool refused = false; //a q value of 0 means it mustn't be used
+    const char *q = params + (params != end);
+    while(q < end && (*q == ' ' || *q == '\t'))
+      q++;
+    if(end - q >= 3 && (*q == 'q' || *q == 'Q') && q[1] == '='){
+      refused = q[2] == '0';
+      for(q += 3; refused && q < end; q++)
+        refused = *q == '.' || *q == '0';
+    }
+    if(refused)
+      continue;
+
+    if(name.equals("*")){
+      accepted |= encoding_bit(BROTLI) | encoding_bit(ZSTD) | encoding_bit(GZIP);
+    }else if(name.equals_case_insensitive("x-gzip")){
+      accepted |= encoding_bit(GZIP);
+    }else{
+      for(const auto encoding : PREFERRED_ENCODINGS)
+        if(name.equals_case_insensitive(ENCODING_NAMES[encoding]))
+          accepted |= encoding_bit(encoding);
+    }
+  }
+  return accepted;
+}
+
+template<server_type T>
+cache_entry_ptr basic_web_server<T>::make_cache_entry(file_body &&body, file_info &&info, const std::string &keep_alive_header){
+  byte_range whole_file{};
+  whole_file.length = body.size();
+
+  std::array<std::string, NUM_HEAD_TYPES> heads{};
+  heads[OK_KEEP_ALIVE] = make_response_head(200, whole_file, info, true, keep_alive_header);
+  heads[OK_CLOSE] = make_response_head(200, whole_file, info, false, keep_alive_header);
+  heads[NOT_MODIFIED_KEEP_ALIVE] = make_not_modified_head(info, true, keep_alive_header);
+  heads[NOT_MODIFIED_CLOSE] = make_not_modified_head(info, false, keep_alive_header);
+
+  return std::make_shared<const cache_entry>(std::move(body), std::move(info), std::move(heads));
+}
+
+template<server_type T>
+void basic_web_server<T>::send_range_not_satisfiable(int client_idx, size_t file_size){
+  auto &client = tcp_clients[client_idx];
+  const std::string headers = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" + std::to_string(file_size) + "\r\n" +
+    (client.keep_alive ? keep_alive_header : "Connection: close\r\n") + "Content-Length: 0\r\n\r\n";
+  client.pending_writes = 1;
+  tcp_server->write_connection(client_idx, std::vector<char>(headers.begin(), headers.end()));
+}
+
+template<server_type T>
+bool basic_web_server<T>::send_file_request(int client_idx, const std::string &filepath, const file_request_headers &request_headers, int response_code){
+  //compressed copies are only sent for whole files, and only once the original is cached, since that's what knows about them
+  const int accepted = response_code == 200 && request_headers.range.empty() ? parse_accept_encoding(request_headers.accept_encoding) : 0;
+
+  cache_entry_ptr compressed{};
+  const auto cached_file = web_cache->fetch_item(filepath, accepted & encoding_bit(GZIP) ? &compressed : nullptr);
+  if(!cached_file)
+    return send_uncached_file(client_idx, filepath, get_content_type(filepath.c_str(), filepath.size()), IDENTITY, request_headers, response_code);
+
+  if(const int precompressed = accepted & cached_file->info.precompressed){ //these are used first, since they can be compressed better than it's done here
+    for(const auto encoding : PREFERRED_ENCODINGS){
+      if(!(precompressed & encoding_bit(encoding)))
+        continue;
+
+      const auto precompressed_path = filepath + ENCODING_EXTENSIONS[encoding];
+      if(const auto precompressed_file = web_cache->fetch_item(precompressed_path)){
+        send_cached_file(client_idx, precompressed_file, request_headers, response_code);
+        return true;
+      }
+      if(send_uncached_file(client_idx, precompressed_path, cached_file->info.content_type, encoding, request_headers, response_code))
+        return true;
+      //otherwise it's been deleted since, so the next best is tried
+    }
+  }
+
+  send_cached_file(client_idx, compressed ? compressed : cached_file, request_headers, response_code);
+  return true;
+}
+
+template<server_type T>
+void basic_web_server<T>::send_cached_file(int client_idx, const cache_entry_ptr &cached_file, const file_request_headers &request_headers, int response_code){
+  auto &client = tcp_clients[client_idx];
+  const auto &info = cached_file->info;
+
+  //the cache is kept up to date with inotify, so the file isn't even opened
+  if(response_code == 200 && is_not_modified(request_headers, info)){ //nothing but the stored headers is needed
+    client.cached_file = cached_file; //the headers are part of the entry, so it's held until they're written
+    client.pending_writes = 1;
+    const auto &head = cached_file->heads[client.keep_alive ? NOT_MODIFIED_KEEP_ALIVE : NOT_MODIFIED_CLOSE];
+    tcp_server->write_connection(client_idx, head.data(), head.size(), cached_file);
+    return;
   }
 
+  const size_t file_size = cached_file->body.size();
+  const auto range = parse_range(response_code == 200 ? request_headers.range : string_span(), file_size);
+  if(!range.satisfiable){
+    send_range_not_satisfiable(client_idx, file_size);
+    return;
+  }
+
+  client.cached_file = cached_file; //so it isn't freed while it's being sent, even if it's evicted
+  client.pending_writes = 1;
+
+  if(response_code == 200 && !range.requested){ //the usual case, the headers were made when it was cached, so nothing is formatted or allocated
+    const auto &head = cached_file->heads[client.keep_alive ? OK_KEEP_ALIVE : OK_CLOSE];
+    tcp_server->write_connection(client_idx, head.data(), head.size(), cached_file->body.data(), file_size, cached_file);
+  }else{ //otherwise new headers are sent, and then just the part of the file asked for
+    const auto headers = make_response_head(response_code, range, info, client.keep_alive, keep_alive_header);
+    tcp_server->write_connection(client_idx, std::vector<char>(headers.begin(), headers.end()), cached_file->body.data() + range.start, range.length, cached_file);
+  }
+}
+
+template<server_type T>
+bool basic_web_server<T>::send_uncached_file(int client_idx, const std::string &filepath, const char *content_type, content_encoding encoding,
+  const file_request_headers &request_headers, int response_code)
+{
+  auto &client = tcp_clients[client_idx];
+  const auto file_fd = open(filepath.c_str(), O_RDONLY);
+
   if(file_fd < 0)
     return false;
 
-  const auto file_size = utility::get_file_size(file_fd);
+  auto info = get_file_info(file_fd, content_type, encoding);
 
-  const auto content_length = std::to_string(file_size);
-  const auto content_type = get_content_type(filepath);
-  
-  const auto cache_data = web_cache.fetch_item(filepath, client_idx, tcp_clients[client_idx]);
-
-  std::string headers = "";
-  if(accept_bytes){
-    headers = header_first_line;
-    headers += content_type;
-    headers += "Accept-Ranges: bytes\r\nContent-Length: ";
-    headers += content_length;
-    headers += "\r\nRange: bytes=0-";
-    headers += content_length;
-    headers += "/";
-  }else{
-    headers = header_first_line;
-    headers += content_type;
-    headers += "Content-Length: ";
+  if(response_code == 200 && is_not_modified(request_headers, info)){
+    close(file_fd);
+    const auto headers = make_not_modified_head(info, client.keep_alive, keep_alive_header);
+    client.pending_writes = 1;
+    tcp_server->write_connection(client_idx, std::vector<char>(headers.begin(), headers.end()));
+    return true;
   }
-  headers += content_length + "\r\n";
 
-  if(!cache_data.found)
-    headers += "Cache-Control: no-cache, no-store, must-revalidate\r\nPragma: no-cache\r\nExpires: 0\r\n";
-  
-  headers += "\r\n";
+  const auto range = parse_range(response_code == 200 ? request_headers.range : string_span(), info.size);
+
+  if(!range.satisfiable){
+    close(file_fd);
+    send_range_not_satisfiable(client_idx, info.size);
+    return true;
+  }
 
-  std::vector<char> send_buffer(file_size + headers.size());
+  const auto headers = make_response_head(response_code, range, info, client.keep_alive, keep_alive_header);
 
-  std::memcpy(&send_buffer[0], headers.c_str(), headers.size());
+  client.pending_writes = 1;
 
-  if(cache_data.found){
-    tcp_server->write_connection(client_idx, cache_data.buff, cache_data.size);
-  }else{
-    tcp_clients[client_idx].last_requested_read_filepath =  filepath; //so that when the file is read, it will be stored with the correct file path
-    tcp_server->custom_read_req(file_fd, file_size, client_idx, std::move(send_buffer), headers.size());
+  if(range.length >= STREAM_FILE_MIN_SIZE){ //large files are streamed straight from the file to the socket, rather than being read into memory
+    std::vector<char> header_buffer(headers.begin(), headers.end());
+    if(tcp_server->write_file_connection(client_idx, file_fd, range.start, range.length, std::move(header_buffer)))
+      return true;
+  }
+
+  if(web_cache->get_backend() == cache_backend::MMAP){ //the whole file is mapped and cached (even for a range), then sent like any other cached file
+    auto body = file_body::map_file(file_fd, info.size);
+    if(body.is_mapped()){
+      close(file_fd); //the mapping stays valid without it
+      if(encoding == IDENTITY)
+        find_precompressed(filepath, info);
+      const auto entry = make_cache_entry(std::move(body), std::move(info), keep_alive_header);
+      cache_file(filepath, entry);
+      send_cached_file(client_idx, entry, request_headers, response_code);
+      return true;
+    }
+  }
+
+  client.cache_last_read = !range.requested; //part of a file can't be cached as if it were the whole thing
+  if(client.cache_last_read && encoding == IDENTITY)
+    find_precompressed(filepath, info);
+
+  client.last_requested_read_filepath =  filepath; //so that when the file is read, it will be stored with the correct file path
+  client.last_requested_read_info = std::move(info);
+  client.last_requested_read_length = range.length;
+  client.response_head.assign(headers.begin(), headers.end());
+  tcp_server->custom_read_req(file_fd, range.length, client_idx, {}, 0, range.start); //only reads the part of the file that's needed, the headers are sent in front of it
+
+  return true;
+}
+
+template<server_type T>
+void basic_web_server<T>::find_precompressed(const std::string &filepath, file_info &info){
+  for(const auto encoding : PREFERRED_ENCODINGS)
+    if(access((filepath + ENCODING_EXTENSIONS[encoding]).c_str(), R_OK) == 0)
+      info.precompressed |= encoding_bit(encoding);
+}
+
+template<server_type T>
+void basic_web_server<T>::cache_file(const std::string &filepath, const cache_entry_ptr &entry){
+  const auto &info = entry->info;
+  const bool cached = web_cache->insert_item(filepath, entry);
+
+  //text is gzipped on the cache's compression thread, unless there's already a gzipped copy next to it
+  if(cached && info.encoding == IDENTITY && !(info.precompressed & encoding_bit(GZIP)) && is_compressible(info.content_type) && info.size >= COMPRESS_MIN_SIZE){
+    const std::string keep_alive = keep_alive_header; //a copy, since this server could be gone by the time the compression thread gets to it
+    web_cache->compress_item(filepath, entry, [keep_alive](file_body &&compressed, const file_info &original){
+      file_info compressed_info = original;
+      compressed_info.size = compressed.size();
+      compressed_info.encoding = GZIP;
+      compressed_info.precompressed = 0;
+      compressed_info.etag.insert(compressed_info.etag.size() - 1, "-gzip"); //it's a different representation of the file, so it needs its own ETag
+      return make_cache_entry(std::move(compressed), std::move(compressed_info), keep_alive);
+    });
+  }
+}
+
+template<server_type T>
+void basic_web_server<T>::file_read_cb(int client_idx, std::vector<char> &&buff){
+  auto &client = tcp_clients[client_idx];
+  if(buff.size() != client.last_requested_read_length){ // the file shrank (or couldn't be read) after the headers were made, so they're wrong now
+    close_connection(client_idx);
+    return;
+  }
+  if(client.cache_last_read){ // only whole files are cached, the entry is made whether or not it fits, and is held until it's been written
+    client.cached_file = make_cache_entry(file_body(std::move(buff)), std::move(client.last_requested_read_info), keep_alive_header);
+    cache_file(client.last_requested_read_filepath, client.cached_file);
+  }else{ // part of a file (from a Range request) is just sent, it's still put in an entry so it has an owner until it's been written
+    client.cached_file = std::make_shared<const cache_entry>(file_body(std::move(buff)), file_info(), std::array<std::string, NUM_HEAD_TYPES>());
+  }
+
+  const auto &file = client.cached_file->body;
+  tcp_server->write_connection(client_idx, std::move(client.response_head), file.data(), file.size(), client.cached_file);
+}
+
+template<server_type T>
+void basic_web_server<T>::http_process_read_cb(int client_idx, const char *buffer, int length){
+  auto &client = tcp_clients[client_idx];
+  client.request_buffer.insert(client.request_buffer.end(), buffer, buffer + length);
+  if(client.pending_writes == 0) //otherwise a response is still being sent, so this is a pipelined request which is dealt with after it
+    process_next_http_request(client_idx);
+}
+
+template<server_type T>
+void basic_web_server<T>::process_next_http_request(int client_idx){
+  auto &client = tcp_clients[client_idx];
+  auto &buff = client.request_buffer;
+  auto &parser = client.parser;
+
+  const auto result = parser.parse(buff.data(), buff.size()); //carries on from wherever it got to last time
+  if(result == http_parse_result::INCOMPLETE){ //the whole request hasn't been received yet
+    if(buff.size() > MAX_REQUEST_HEADER_SIZE){
+      close_connection(client_idx);
+      return;
+    }
+    if(!client.waiting_for_request){ //idle from now on, partial requests don't reset this
+      client.waiting_for_request = true;
+      client.idle_since_tick = idle_ticks;
+    }
+    tcp_server->read_connection(client_idx);
+    return;
+  }
+
+  const size_t request_length = parser.request_length();
+  client.waiting_for_request = false;
+  client.requests_served++;
+
+  if(result == http_parse_result::ERROR || !is_valid_http_req(buff.data(), request_length)){
+    close_connection(client_idx);
+    return;
   }
 
+  //all of these point into buff, so the request is only removed from it once it's been dealt with
+  const auto method = parser.method();
+  const auto target = parser.target();
+  const auto connection = parser.header("Connection");
+  file_request_headers request_headers{};
+  request_headers.range = parser.header("Range");
+  request_headers.if_none_match = parser.header("If-None-Match");
+  request_headers.if_modified_since = parser.header("If-Modified-Since");
+  request_headers.accept_encoding = parser.header("Accept-Encoding");
+  const auto websocket_key = parser.header("Sec-WebSocket-Key");
+
+  const bool is_GET = method.equals("GET");
+
+  //HTTP/1.1 connections are persistent unless the client says otherwise, HTTP/1.0 ones only if the client asks
+  const bool persistent = parser.version().equals("HTTP/1.1") ? !connection.has_token("close") : connection.has_token("keep-alive");
+  client.keep_alive = is_GET && persistent && client.requests_served < settings.keep_alive_max_requests;
+
+  std::string path = is_GET ? std::string(target.data + 1, target.length - 1) : ""; //if it's a valid request it should be a path
+  const std::string sec_websocket_key = websocket_key.empty() ? "" : std::string(websocket_key.data, websocket_key.length);
+
+  //early data could be a replay of an earlier connection's, which is harmless for a GET of a file, but not for opening a websocket
+  if(is_GET && !websocket_key.empty() && tcp_server->is_early_data(client_idx)){
+    client.keep_alive = false;
+    client.pending_writes = 1; //so nothing pipelined behind it is answered before the connection closes
+    buff.clear(); //the connection closes once it's written, so nothing after this request is looked at
+    parser.reset();
+    const std::string too_early = "HTTP/1.1 425 Too Early\r\nConnection: close\r\nContent-Length: 0\r\n\r\n"; //the client sends it again after the handshake
+    tcp_server->write_connection(client_idx, std::vector<char>(too_early.begin(), too_early.end()));
+    return;
+  }else if(!is_GET || !get_process(path, request_headers, sec_websocket_key, client_idx)){ //get callback, if unsuccesful then 404
+    if(!send_file_request(client_idx, "public/404.html", file_request_headers(), 400)) //sends 404 request, should be cached if possible
+      close_connection(client_idx); //nothing could be sent
+  }else if(active_websocket_connections_client_idxs.count(client_idx)){ // if it's a websocket
+    client.keep_alive = false; //it's not HTTP anymore
+    tcp_server->read_connection(client_idx); // read from the socket immediately
+  }
+
+  buff.erase(buff.begin(), buff.begin() + request_length); //anything left is the next pipelined request
+  parser.reset();
+}
+
+template<server_type T>
+bool basic_web_server<T>::http_process_write_cb(int client_idx){
+  auto &client = tcp_clients[client_idx];
+  client.cached_file = nullptr; //the response has been sent, so it's done with any cached file
+  if(!client.keep_alive)
+    return false;
+
+  process_next_http_request(client_idx); //either responds to a pipelined request, or waits for the next one
   return true;
 }
 
+template<server_type T>
+void basic_web_server<T>::close_idle_connections(){
+  idle_ticks++;
+  for(int client_idx = 0; client_idx < tcp_clients.size(); client_idx++){
+    const auto &client = tcp_clients[client_idx];
+    if(client.waiting_for_request && idle_ticks - client.idle_since_tick >= settings.keep_alive_timeout)
+      close_connection(client_idx);
+  }
+}
+
 template<server_type T>
 void basic_web_server<T>::set_tcp_server(tcp_tls_server::server<T> *server){
   tcp_server = server;
-  tcp_server->custom_read_req(web_cache.inotify_fd, sizeof(inotify_event)); //always read from inotify_fd - we only read size of event, since we monitor files
+  keep_alive_header = "Connection: keep-alive\r\nKeep-Alive: timeout=" + std::to_string(settings.keep_alive_timeout) + "\r\n";
+  // 1s timer, for closing idle keep-alive connections
+  itimerspec timer_values{};
+  timer_values.it_value.tv_sec = 1;
+  timer_values.it_interval.tv_sec = 1;
+  timerfd_settime(idle_timerfd, 0, &timer_values, nullptr);
+  tcp_server->custom_read_req(idle_timerfd, sizeof(uint64_t));
+
+  if(broadcasts) //the central thread wakes this thread with an event when it's broadcast something
+    broadcast_consumer = broadcasts->add_consumer([server]{ server->notify_event(); });
 }
 
 template<server_type T>
@@ -138,12 +537,15 @@ void basic_web_server<T>::new_tcp_client(int client_idx){
   if(client_idx + 1 >= tcp_clients.size()) //size starts from 1, idx starts from 0
     tcp_clients.resize(client_idx + 1);
   tcp_clients[client_idx] = tcp_client();
+  tcp_clients[client_idx].waiting_for_request = true; //closed if the first request doesn't arrive in time
+  tcp_clients[client_idx].idle_since_tick = idle_ticks;
 }
 
 template<server_type T>
 void basic_web_server<T>::kill_client(int client_idx){
-  web_cache.finished_with_item(client_idx, tcp_clients[client_idx]);
-  tcp_clients[client_idx].using_file = false;
+  tcp_clients[client_idx].cached_file = nullptr;
+  tcp_clients[client_idx].keep_alive = false;
+  tcp_clients[client_idx].waiting_for_request = false;
 
   int ws_client_idx = tcp_clients[client_idx].ws_client_idx;
   all_websocket_connections.erase(ws_client_idx); //connection definitely closed now
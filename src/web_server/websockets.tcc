@@ -328,4 +328,24 @@ std::pair<int, std::vector<std::vector<char>>> basic_web_server<T>::get_ws_frame
   }
 
   return {1, frames};
-}
\ No newline at end of file
+}
+
+template<server_type T>
+void basic_web_server<T>::receive_broadcasts(){
+  if(broadcast_consumer == -1) return;
+  broadcasts->drain(broadcast_consumer, [this](const broadcast_frame &frame){ websocket_broadcast(frame); });
+}
+
+template<server_type T>
+void basic_web_server<T>::stop_receiving_broadcasts(){
+  if(broadcast_consumer == -1) return;
+  broadcasts->remove_consumer(broadcast_consumer);
+  broadcast_consumer = -1;
+}
+
+template<server_type T>
+void basic_web_server<T>::websocket_broadcast(const broadcast_frame &frame){
+  const auto &client_idxs = active_websocket_connections_client_idxs;
+  //each client's write holds a reference to the frame, so it's freed once the last write of it (on any thread) is done
+  tcp_server->broadcast_message(client_idxs.cbegin(), client_idxs.cend(), client_idxs.size(), frame);
+}